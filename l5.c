@@ -36,6 +36,13 @@ This is for Lua 5.3+ only, built with default 64-bit integers
 #include <sys/wait.h>	// waitpid 
 #include <sys/mount.h>	// mount umount
 #include <sys/mman.h>	// mmap and friends
+#include <sys/eventfd.h>	// eventfd
+#include <pthread.h>	// worker pool threads
+#include <sys/inotify.h>	// inotify
+#include <sched.h>	// sched_setaffinity, sched_setscheduler
+#include <sys/resource.h>	// setpriority, prlimit
+#include <sys/syscall.h>	// SYS_ioprio_set, SYS_ioprio_get
+#include <linux/errqueue.h>	// zerocopy completion notifications
 
 
 #include "lua.h"
@@ -154,6 +161,18 @@ static int ll_msleep(lua_State *L) {
 	return int_or_errno(L, nanosleep(&req, NULL));
 }
 
+static int ll_clock_gettime(lua_State *L) {
+	// lua api: clock_gettime([clockid]) => sec, nsec | nil, errno
+	// clockid defaults to 0 (CLOCK_REALTIME). 
+	// (1 is CLOCK_MONOTONIC - see time.h)
+	int clk = luaL_optinteger(L, 1, CLOCK_REALTIME);
+	struct timespec ts;
+	if (clock_gettime(clk, &ts) == -1) return nil_errno(L);
+	lua_pushinteger(L, ts.tv_sec);
+	lua_pushinteger(L, ts.tv_nsec);
+	return 2;
+}
+
 static int ll_fork(lua_State *L) {
 	// fork the current process (fork(2))
 	// lua api: fork() => pid | nil, errno
@@ -217,6 +236,148 @@ static int ll_execve(lua_State *L) {
 	return nil_errno(L); // execve returns only on error
 }
 
+//----------------------------------------------------------------------
+// scheduling, cpu affinity, priorities, resource limits
+
+static int ll_sched_setaffinity(lua_State *L) {
+	// lua api: sched_setaffinity(pid, cpulist) => 0 | nil, errno
+	// pid=0 is the calling process (or thread)
+	// cpulist is a list of cpu numbers (0-based), eg. {0, 2, 3}
+	int pid = luaL_checkinteger(L, 1);
+	cpu_set_t set;
+	int i, cpu, n;
+	luaL_checktype(L, 2, LUA_TTABLE);
+	n = luaL_len(L, 2);
+	CPU_ZERO(&set);
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, 2, i);
+		cpu = luaL_checkinteger(L, -1);
+		lua_pop(L, 1);
+		if (cpu < 0 || cpu >= CPU_SETSIZE) LERR("out of range");
+		CPU_SET(cpu, &set);
+	}
+	return int_or_errno(L, sched_setaffinity(pid, sizeof(set), &set));
+}
+
+static int ll_sched_getaffinity(lua_State *L) {
+	// lua api: sched_getaffinity(pid) => cpulist | nil, errno
+	// return the list of cpus the process is allowed to run on
+	int pid = luaL_optinteger(L, 1, 0);
+	cpu_set_t set;
+	int cpu, n = 0;
+	if (sched_getaffinity(pid, sizeof(set), &set) == -1) 
+		return nil_errno(L);
+	lua_newtable(L);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &set)) continue;
+		lua_pushinteger(L, cpu);
+		lua_rawseti(L, -2, ++n);
+	}
+	return 1;
+}
+
+static int ll_sched_setscheduler(lua_State *L) {
+	// lua api: sched_setscheduler(pid, policy [, prio]) => 0 | nil, errno
+	// policy: 0=SCHED_OTHER, 1=SCHED_FIFO, 2=SCHED_RR, 3=SCHED_BATCH,
+	// 5=SCHED_IDLE. prio (defaults to 0) must be 0 for the 
+	// non-realtime policies, and 1-99 for FIFO and RR.
+	int pid = luaL_checkinteger(L, 1);
+	int policy = luaL_checkinteger(L, 2);
+	struct sched_param sp;
+	sp.sched_priority = luaL_optinteger(L, 3, 0);
+	return int_or_errno(L, sched_setscheduler(pid, policy, &sp));
+}
+
+static int ll_sched_getscheduler(lua_State *L) {
+	// lua api: sched_getscheduler(pid) => policy, prio | nil, errno
+	int pid = luaL_optinteger(L, 1, 0);
+	struct sched_param sp;
+	int policy = sched_getscheduler(pid);
+	if (policy == -1) return nil_errno(L);
+	if (sched_getparam(pid, &sp) == -1) return nil_errno(L);
+	lua_pushinteger(L, policy);
+	lua_pushinteger(L, sp.sched_priority);
+	return 2;
+}
+
+static int ll_setpriority(lua_State *L) {
+	// lua api: setpriority(which, who, prio) => 0 | nil, errno
+	// which: 0=PRIO_PROCESS, 1=PRIO_PGRP, 2=PRIO_USER
+	// who=0 is the calling process (or pgrp, or user)
+	// prio is the nice value (-20 to 19)
+	int which = luaL_checkinteger(L, 1);
+	int who = luaL_checkinteger(L, 2);
+	int prio = luaL_checkinteger(L, 3);
+	return int_or_errno(L, setpriority(which, who, prio));
+}
+
+static int ll_getpriority(lua_State *L) {
+	// lua api: getpriority(which, who) => prio | nil, errno
+	int which = luaL_optinteger(L, 1, PRIO_PROCESS);
+	int who = luaL_optinteger(L, 2, 0);
+	errno = 0;
+	int prio = getpriority(which, who);
+	// -1 is a valid nice value. check errno.
+	if (prio == -1 && errno != 0) return nil_errno(L);
+	RET_INT(prio);
+}
+
+static int ll_ioprio_set(lua_State *L) {
+	// lua api: ioprio_set(which, who, class, level) => 0 | nil, errno
+	// which: 1=IOPRIO_WHO_PROCESS, 2=IOPRIO_WHO_PGRP, 3=IOPRIO_WHO_USER
+	// class: 1=IOPRIO_CLASS_RT, 2=IOPRIO_CLASS_BE, 3=IOPRIO_CLASS_IDLE
+	// level: 0 (highest) to 7 (lowest)
+	int which = luaL_checkinteger(L, 1);
+	int who = luaL_checkinteger(L, 2);
+	int class = luaL_checkinteger(L, 3);
+	int level = luaL_optinteger(L, 4, 0);
+	return int_or_errno(L, 
+		syscall(SYS_ioprio_set, which, who, (class << 13) | level));
+}
+
+static int ll_ioprio_get(lua_State *L) {
+	// lua api: ioprio_get(which, who) => class, level | nil, errno
+	int which = luaL_optinteger(L, 1, 1);
+	int who = luaL_optinteger(L, 2, 0);
+	int r = syscall(SYS_ioprio_get, which, who);
+	if (r == -1) return nil_errno(L);
+	lua_pushinteger(L, r >> 13);
+	lua_pushinteger(L, r & 0x1fff);
+	return 2;
+}
+
+static int ll_prlimit(lua_State *L) {
+	// lua api: prlimit(pid, resource [, soft, hard]) 
+	//	=> oldsoft, oldhard | nil, errno
+	// get and optionally set a resource limit (see getrlimit(2) 
+	// for the RLIMIT_* resource values)
+	// pid=0 is the calling process. 
+	// if soft and hard are not provided, the limit is not changed.
+	// if only soft is provided, hard is not changed.
+	// the value -1 is RLIM_INFINITY
+	int pid = luaL_checkinteger(L, 1);
+	int res = luaL_checkinteger(L, 2);
+	struct rlimit old, new, *pnew = NULL;
+	if (!lua_isnoneornil(L, 3)) {
+		if (prlimit(pid, res, NULL, &old) == -1) return nil_errno(L);
+		new.rlim_cur = (rlim_t) luaL_checkinteger(L, 3);
+		new.rlim_max = (rlim_t) luaL_optinteger(L, 4, old.rlim_max);
+		pnew = &new;
+	}
+	if (prlimit(pid, res, pnew, &old) == -1) return nil_errno(L);
+	lua_pushinteger(L, (lua_Integer) old.rlim_cur);
+	lua_pushinteger(L, (lua_Integer) old.rlim_max);
+	return 2;
+}
+
+static int ll_nprocs(lua_State *L) {
+	// lua api: nprocs() => online, configured
+	// return the number of online and configured processors
+	lua_pushinteger(L, sysconf(_SC_NPROCESSORS_ONLN));
+	lua_pushinteger(L, sysconf(_SC_NPROCESSORS_CONF));
+	return 2;
+}
+
 //----------------------------------------------------------------------
 // basic I/O
 
@@ -275,9 +436,9 @@ static int ll_write(lua_State *L) {
 	size_t len, idx, count;
 	const char *str = luaL_checklstring(L, 2, &len);	
 	idx = luaL_optinteger(L, 3, 1);
-	count = len + idx - 1;
-	count = luaL_optinteger(L, 4, count);
-	if ((idx < 1) || (idx + count - 1 > len)) LERR("out of range");
+	if ((idx < 1) || (idx > len + 1)) LERR("out of range");
+	count = luaL_optinteger(L, 4, len - idx + 1);
+	if (count > len - idx + 1) LERR("out of range");
 	return int_or_errno(L, write(fd, str + idx - 1, count));
 }
 
@@ -341,6 +502,579 @@ static int ll_ftruncate(lua_State *L) {
 
 
 
+//----------------------------------------------------------------------
+// whole-file read and write
+
+// writefile() flags
+#define WF_ATOMIC	1	// write a temp file, then rename it
+#define WF_SYNC		2	// fdatasync the file before closing it
+#define WF_SYNCDIR	4	// fsync the directory after rename
+
+static int close_errno(lua_State *L, int fd) {
+	// close fd and return nil, errno (errno is preserved)
+	int eno = errno;
+	close(fd);
+	errno = eno;
+	return nil_errno(L);
+}
+
+static int ll_readfile(lua_State *L) {
+	// lua api: readfile(path) => str | nil, errno
+	// return the content of a file. the file size is obtained 
+	// with fstat() and the content is read at once in a buffer of 
+	// the right size. Files with no meaningful size (eg. files 
+	// in /proc) are read until EOF.
+	// (mmap is not used: the content is copied in the Lua string 
+	// anyway, and a file truncated during the copy would raise 
+	// SIGBUS)
+	const char *pname = luaL_checkstring(L, 1);
+	struct stat st;
+	luaL_Buffer b;
+	char tmp[BUFSIZE];
+	size_t size, len = 0;
+	ssize_t n;
+	char *p;
+	int fd = open(pname, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return nil_errno(L);
+	if (fstat(fd, &st) == -1) return close_errno(L, fd);
+	size = S_ISREG(st.st_mode) ? st.st_size : 0;
+	p = luaL_buffinitsize(L, &b, size);
+	while (len < size) {
+		n = read(fd, p + len, size - len);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return close_errno(L, fd);
+		}
+		if (n == 0) break;
+		len += n;
+	}
+	luaL_addsize(&b, len);
+	// read until EOF (the file may have grown, or its size is 0)
+	while (len == size) {
+		n = read(fd, tmp, BUFSIZE);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return close_errno(L, fd);
+		}
+		if (n == 0) break;
+		luaL_addlstring(&b, tmp, n);
+	}
+	close(fd);
+	luaL_pushresult(&b);
+	return 1;
+}
+
+static int writeall(int fd, const char *p, size_t len) {
+	// write len bytes, retrying on partial writes
+	// return 0 or -1 (errno is set)
+	ssize_t n;
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int syncdir(const char *pname) {
+	// fsync the directory containing pname
+	char dname[4096];
+	const char *sl = strrchr(pname, '/');
+	size_t dlen = sl ? (size_t)(sl - pname) : 0;
+	int fd, r;
+	if (sl == NULL) strcpy(dname, ".");
+	else if (dlen == 0) strcpy(dname, "/");
+	else if (dlen >= sizeof(dname)) { errno = ENAMETOOLONG; return -1; }
+	else { memcpy(dname, pname, dlen); dname[dlen] = 0; }
+	fd = open(dname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1) return -1;
+	r = fsync(fd);
+	close(fd);
+	return r;
+}
+
+static int ll_writefile(lua_State *L) {
+	// lua api: writefile(path, str [, flags, mode, size]) 
+	//	=> true | nil, errno
+	// write string str to file path (the file is created or 
+	// truncated)
+	// flags is an OR of:
+	//	1 (atomic): str is written to a temporary file in the
+	//	   same directory, which is synced with fdatasync() and 
+	//	   renamed to path. A reader sees either the old or the 
+	//	   new content.
+	//	2 (sync): fdatasync the file before closing it
+	//	4 (syncdir): fsync the directory after renaming the file
+	//	   (only with atomic. makes the rename durable)
+	// flags defaults to 0.
+	// mode is the file mode (defaults to 0666 - modified by umask).
+	// if size is provided and larger than #str, disk space is 
+	// preallocated up to size bytes with fallocate() (the file
+	// size is not changed).
+	size_t len;
+	const char *pname = luaL_checkstring(L, 1);
+	const char *str = luaL_checklstring(L, 2, &len);
+	int flags = luaL_optinteger(L, 3, 0);
+	int mode = luaL_optinteger(L, 4, 0666);
+	off_t size = luaL_optinteger(L, 5, 0);
+	char tname[4096];
+	static unsigned int tcnt = 0;
+	const char *fname = pname;
+	int fd, i;
+	if (flags & WF_ATOMIC) {
+		// create a new temp file (O_EXCL) next to the file
+		for (i = 0; i < 100; i++) {
+			if (snprintf(tname, sizeof(tname), "%s.tmp%d-%u", 
+				pname, getpid(), tcnt++) >= sizeof(tname)) {
+				errno = ENAMETOOLONG;
+				return nil_errno(L);
+			}
+			fd = open(tname, 
+				O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+			if (fd != -1 || errno != EEXIST) break;
+		}
+		fname = tname;
+		flags |= WF_SYNC;
+	} else {
+		fd = open(pname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 
+			mode);
+	}
+	if (fd == -1) return nil_errno(L);
+	// preallocation is only an optimization. ignore errors
+	// (eg. EOPNOTSUPP on filesystems without fallocate)
+	if (size > len) fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+	if (writeall(fd, str, len) == -1) goto err;
+	if ((flags & WF_SYNC) && fdatasync(fd) == -1) goto err;
+	if (close(fd) == -1) { fd = -1; goto err; }
+	fd = -1;
+	if (flags & WF_ATOMIC) {
+		if (rename(tname, pname) == -1) goto err;
+		if ((flags & WF_SYNCDIR) && syncdir(pname) == -1) 
+			return nil_errno(L);
+	}
+	RET_TRUE;
+	err: {
+		int eno = errno;
+		if (fd != -1) close(fd);
+		if (flags & WF_ATOMIC) unlink(fname);
+		errno = eno;
+		return nil_errno(L);
+	}
+}
+
+//----------------------------------------------------------------------
+// append-only log with group commit
+//
+// a log is a full userdata bound to a directory of segment files.
+// A segment is named after the sequence number of its first record 
+// (16 hex digits + ".log") and is preallocated with fallocate(). 
+// A record is a 16-byte header followed by the record data:
+//	uint32 len	data length
+//	uint32 crc	crc32 of len, seq and data
+//	uint64 seq	record sequence number (the first record is 1)
+// (integers are stored in native byte order)
+//
+// alog_append() only copies the record in a staging buffer and returns
+// its sequence number. alog_commit() writes all the pending records 
+// with one pwrite() and makes them durable with one fdatasync() (or
+// sync_file_range() - see ALOG_SYNCRANGE). Appends made during a 
+// commit window are thus flushed together ("group commit").
+// When the current segment is full, a new segment is started at the 
+// next commit. Records never span segments.
+//
+// On open, the last segment is scanned, and the log ends at the first 
+// record which is truncated, out of sequence or has a bad crc (eg. a 
+// torn write during a crash). What follows is discarded.
+
+#define ALOG_MT "l5_alog"
+#define ALOG_HLEN 16
+#define ALOG_SYNCRANGE 1	// use sync_file_range() instead of fdatasync()
+
+typedef struct alog {
+	int fd;			// current segment (-1 when closed)
+	int flags;
+	char *dir;		// log directory
+	off_t segsize;		// segment preallocated size
+	off_t off;		// write offset in the current segment
+	uint64_t lastseq;	// last appended record
+	uint64_t commitseq;	// last durable record
+	char *buf;		// staging buffer for pending records
+	size_t blen, bcap;
+} alog;
+
+static uint32_t crc32_table[256];
+
+static uint32_t crc32_update(uint32_t crc, const void *p, size_t len) {
+	// standard crc32 (IEEE 802.3, as in zlib). initial crc is 0.
+	const unsigned char *s = p;
+	if (crc32_table[1] == 0) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) 
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			crc32_table[i] = c;
+		}
+	}
+	crc = ~crc;
+	while (len--) crc = crc32_table[(crc ^ *s++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t alog_crc(uint32_t len, uint64_t seq, const char *data) {
+	uint32_t crc = crc32_update(0, &len, 4);
+	crc = crc32_update(crc, &seq, 8);
+	return crc32_update(crc, data, len);
+}
+
+static off_t alog_scan(lua_State *L, const char *p, size_t size, 
+		uint64_t *seq) {
+	// scan the records in a segment content (p, size). *seq is the 
+	// sequence number of the first expected record. It is updated 
+	// to the sequence number of the record after the last valid one.
+	// if L is not NULL, the records are appended as {seq, data} 
+	// to the list at the top of the stack.
+	// return the offset after the last valid record
+	size_t off = 0;
+	uint32_t len, crc;
+	uint64_t rseq;
+	int n = 0;
+	while (size - off >= ALOG_HLEN) {
+		memcpy(&len, p + off, 4);
+		memcpy(&crc, p + off + 4, 4);
+		memcpy(&rseq, p + off + 8, 8);
+		if (rseq != *seq || len > size - off - ALOG_HLEN) break;
+		if (crc != alog_crc(len, rseq, p + off + ALOG_HLEN)) break;
+		if (L != NULL) {
+			lua_createtable(L, 2, 0);
+			lua_pushinteger(L, rseq);
+			lua_rawseti(L, -2, 1);
+			lua_pushlstring(L, p + off + ALOG_HLEN, len);
+			lua_rawseti(L, -2, 2);
+			lua_rawseti(L, -2, ++n);
+		}
+		off += ALOG_HLEN + len;
+		(*seq)++;
+	}
+	return off;
+}
+
+static int alog_segopen(alog *lg, uint64_t seq0, int create) {
+	// open (or create) the segment starting at record seq0
+	// return fd or -1 (errno is set)
+	char pname[4096];
+	int fd;
+	if (snprintf(pname, sizeof(pname), "%s/%016llx.log", lg->dir, 
+			(unsigned long long)seq0) >= sizeof(pname)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (!create) return open(pname, O_RDWR | O_CLOEXEC);
+	fd = open(pname, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd == -1) return -1;
+	// reserve the whole segment so that commits do not allocate 
+	// blocks (which would add metadata updates to each fdatasync). 
+	// KEEP_SIZE leaves the file size at the end of the written 
+	// records, where the scan on open stops. If fallocate fails,
+	// the segment just grows with each commit.
+	fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, lg->segsize);
+	if (syncdir(pname) == -1) {
+		int eno = errno;
+		close(fd);
+		unlink(pname);
+		errno = eno;
+		return -1;
+	}
+	return fd;
+}
+
+static alog *checkalog(lua_State *L, int i) {
+	alog *lg = luaL_checkudata(L, i, ALOG_MT);
+	if (lg->fd == -1) luaL_error(L, "log is closed");
+	return lg;
+}
+
+static int ll_alog_close(lua_State *L) {
+	// lua api: alog_close(log)
+	// close the log. pending records are discarded (see alog_commit)
+	// (this is also the log __gc metamethod)
+	alog *lg = luaL_checkudata(L, 1, ALOG_MT);
+	if (lg->fd != -1) close(lg->fd);
+	lg->fd = -1;
+	free(lg->dir);
+	free(lg->buf);
+	lg->dir = lg->buf = NULL;
+	lg->blen = lg->bcap = 0;
+	RET_TRUE;
+}
+
+static int ll_alog_open(lua_State *L) {
+	// lua api: alog_open(dirpath [, segsize, flags]) => log, lastseq
+	// open the log in directory dirpath (the directory must exist). 
+	// A new log is created if the directory contains no segment.
+	// segsize is the segment size (defaults to 64 MB).
+	// flags: ALOG_SYNCRANGE (1): commit with sync_file_range() 
+	// instead of fdatasync() (faster, but not durable across a power
+	// loss: device caches are not flushed, nor the file metadata)
+	// return the log and the sequence number of the last record
+	// (0 for an empty log), or nil, errno
+	const char *dname = luaL_checkstring(L, 1);
+	off_t segsize = luaL_optinteger(L, 2, 64 * 1024 * 1024);
+	int flags = luaL_optinteger(L, 3, 0);
+	uint64_t seq0 = 0, seq;
+	struct dirent *de;
+	struct stat st;
+	char *p;
+	alog *lg = lua_newuserdata(L, sizeof(alog));
+	memset(lg, 0, sizeof(alog));
+	lg->fd = -1;
+	luaL_getmetatable(L, ALOG_MT);
+	lua_setmetatable(L, -2);
+	lg->dir = strdup(dname);
+	if (lg->dir == NULL) LERR("alog_open: out of memory");
+	lg->segsize = segsize;
+	lg->flags = flags;
+	// find the last segment
+	DIR *dp = opendir(dname);
+	if (dp == NULL) return nil_errno(L);
+	while ((de = readdir(dp)) != NULL) {
+		char *end;
+		if (strlen(de->d_name) != 20) continue;
+		seq = strtoull(de->d_name, &end, 16);
+		if (end != de->d_name + 16 || strcmp(end, ".log")) continue;
+		if (seq > seq0) seq0 = seq;
+	}
+	closedir(dp);
+	if (seq0 == 0) { // new log
+		lg->fd = alog_segopen(lg, 1, 1);
+		if (lg->fd == -1) return nil_errno(L);
+		lua_pushinteger(L, 0);
+		return 2;
+	}
+	// scan the last segment to find the end of the log
+	lg->fd = alog_segopen(lg, seq0, 0);
+	if (lg->fd == -1) return nil_errno(L);
+	if (fstat(lg->fd, &st) == -1) return nil_errno(L);
+	seq = seq0;
+	if (st.st_size > 0) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, lg->fd, 0);
+		if (p == MAP_FAILED) return nil_errno(L);
+		lg->off = alog_scan(NULL, p, st.st_size, &seq);
+		munmap(p, st.st_size);
+	}
+	// drop a torn tail (and restore the preallocation)
+	if (lg->off < st.st_size) {
+		if (ftruncate(lg->fd, lg->off) == -1) return nil_errno(L);
+		fallocate(lg->fd, FALLOC_FL_KEEP_SIZE, 0, lg->segsize);
+	}
+	lg->lastseq = lg->commitseq = seq - 1;
+	lua_pushinteger(L, lg->lastseq);
+	return 2;
+}
+
+static int ll_alog_append(lua_State *L) {
+	// lua api: alog_append(log, str) => seq
+	// append a record to the log. The record is durable only after
+	// the next alog_commit().
+	// return the record sequence number
+	alog *lg = checkalog(L, 1);
+	size_t len;
+	const char *str = luaL_checklstring(L, 2, &len);
+	if (len > 0xffffffff) LERR("alog_append: record too large");
+	size_t need = lg->blen + ALOG_HLEN + len;
+	if (need > lg->bcap) {
+		size_t ncap = lg->bcap ? lg->bcap : 64 * 1024;
+		while (ncap < need) ncap *= 2;
+		char *np = realloc(lg->buf, ncap);
+		if (np == NULL) LERR("alog_append: out of memory");
+		lg->buf = np;
+		lg->bcap = ncap;
+	}
+	uint32_t len32 = len;
+	uint64_t seq = lg->lastseq + 1;
+	uint32_t crc = alog_crc(len32, seq, str);
+	char *h = lg->buf + lg->blen;
+	memcpy(h, &len32, 4);
+	memcpy(h + 4, &crc, 4);
+	memcpy(h + 8, &seq, 8);
+	memcpy(h + ALOG_HLEN, str, len);
+	lg->blen = need;
+	lg->lastseq = seq;
+	RET_INT(seq);
+}
+
+static int ll_alog_commit(lua_State *L) {
+	// lua api: alog_commit(log) => seq | nil, errno
+	// write the pending records and make them durable.
+	// return the sequence number of the last durable record.
+	// in case of error, the pending records are kept and the commit
+	// can be retried.
+	alog *lg = checkalog(L, 1);
+	ssize_t n;
+	size_t done = 0;
+	int r;
+	if (lg->blen == 0) RET_INT(lg->commitseq);
+	if (lg->off > 0 && lg->off + lg->blen > lg->segsize) {
+		// start a new segment
+		int fd = alog_segopen(lg, lg->commitseq + 1, 1);
+		if (fd == -1) return nil_errno(L);
+		close(lg->fd);
+		lg->fd = fd;
+		lg->off = 0;
+	}
+	while (done < lg->blen) {
+		n = pwrite(lg->fd, lg->buf + done, lg->blen - done, 
+			lg->off + done);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return nil_errno(L);
+		}
+		done += n;
+	}
+	if (lg->flags & ALOG_SYNCRANGE) 
+		r = sync_file_range(lg->fd, lg->off, lg->blen, 
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+			| SYNC_FILE_RANGE_WAIT_AFTER);
+	else 
+		r = fdatasync(lg->fd);
+	if (r == -1) return nil_errno(L);
+	lg->off += lg->blen;
+	lg->blen = 0;
+	lg->commitseq = lg->lastseq;
+	RET_INT(lg->commitseq);
+}
+
+static int ll_alog_seq(lua_State *L) {
+	// lua api: alog_seq(log) => lastseq, commitseq, pending
+	// return the sequence numbers of the last appended record and of 
+	// the last durable record, and the size of the pending records
+	// in bytes.
+	alog *lg = checkalog(L, 1);
+	lua_pushinteger(L, lg->lastseq);
+	lua_pushinteger(L, lg->commitseq);
+	lua_pushinteger(L, lg->blen);
+	return 3;
+}
+
+static int ll_alog_readseg(lua_State *L) {
+	// lua api: alog_readseg(path) => { {seq, str}, ... } | nil, errno
+	// return the valid records of a log segment file, eg. to replay
+	// a log. (the first record seq is given by the segment name)
+	const char *pname = luaL_checkstring(L, 1);
+	const char *bname = strrchr(pname, '/');
+	uint64_t seq;
+	struct stat st;
+	char *p;
+	bname = bname ? bname + 1 : pname;
+	seq = strtoull(bname, NULL, 16);
+	int fd = open(pname, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return nil_errno(L);
+	if (fstat(fd, &st) == -1) return close_errno(L, fd);
+	lua_newtable(L);
+	if (st.st_size == 0) { close(fd); return 1; }
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) return close_errno(L, fd);
+	close(fd);
+	alog_scan(L, p, st.st_size, &seq);
+	munmap(p, st.st_size);
+	return 1;
+}
+
+//----------------------------------------------------------------------
+// buffers - mutable byte arrays owned by Lua (full userdata)
+//
+// a buffer can be passed to syscalls that work in place on a 
+// caller-owned argument (eg. ioctl_buf() below). Its content is
+// accessed with buf_get() and buf_set(). Indices are 1-based, as
+// for Lua strings.
+
+#define BUFFER_MT "l5_buffer"
+
+typedef struct l5buf {
+	char *p;
+	size_t size;
+} l5buf;
+
+static int ll_buf_free(lua_State *L) {
+	// lua api: buf_free(b)
+	// release the buffer memory. the buffer size is then 0.
+	// (this is also the buffer __gc metamethod)
+	l5buf *b = luaL_checkudata(L, 1, BUFFER_MT);
+	free(b->p);
+	b->p = NULL;
+	b->size = 0;
+	RET_TRUE;
+}
+
+static int ll_buf_new(lua_State *L) {
+	// lua api: buf_new(size [, str]) => buffer
+	// create a zero-filled buffer of size bytes. if str is 
+	// provided, it is copied at the beginning of the buffer.
+	size_t len = 0;
+	size_t size = luaL_checkinteger(L, 1);
+	const char *str = luaL_optlstring(L, 2, "", &len);
+	if (len > size) LERR("buf_new: str too large");
+	l5buf *b = lua_newuserdata(L, sizeof(l5buf));
+	b->p = NULL;
+	b->size = 0;
+	luaL_getmetatable(L, BUFFER_MT);
+	lua_setmetatable(L, -2);
+	b->p = calloc(1, size ? size : 1);
+	if (b->p == NULL) LERR("buf_new: out of memory");
+	b->size = size;
+	memcpy(b->p, str, len);
+	return 1;
+}
+
+static int ll_buf_size(lua_State *L) {
+	// lua api: buf_size(b) => size
+	l5buf *b = luaL_checkudata(L, 1, BUFFER_MT);
+	RET_INT(b->size);
+}
+
+static int ll_buf_resize(lua_State *L) {
+	// lua api: buf_resize(b, size) => true
+	// the buffer content is preserved (up to size bytes).
+	// new bytes are set to zero.
+	l5buf *b = luaL_checkudata(L, 1, BUFFER_MT);
+	size_t size = luaL_checkinteger(L, 2);
+	char *p = realloc(b->p, size ? size : 1);
+	if (p == NULL) LERR("buf_resize: out of memory");
+	if (size > b->size) memset(p + b->size, 0, size - b->size);
+	b->p = p;
+	b->size = size;
+	RET_TRUE;
+}
+
+static int ll_buf_get(lua_State *L) {
+	// lua api: buf_get(b [, idx, count]) => str
+	// return count bytes of the buffer starting at index idx.
+	// idx defaults to 1, count defaults to (size - idx + 1)
+	l5buf *b = luaL_checkudata(L, 1, BUFFER_MT);
+	size_t idx = luaL_optinteger(L, 2, 1);
+	if ((idx < 1) || (idx > b->size + 1)) LERR("out of range");
+	size_t count = luaL_optinteger(L, 3, b->size - idx + 1);
+	if (count > b->size - idx + 1) LERR("out of range");
+	RET_STRN(b->p + idx - 1, count);
+}
+
+static int ll_buf_set(lua_State *L) {
+	// lua api: buf_set(b, idx, str) => true
+	// copy string str in the buffer at index idx
+	l5buf *b = luaL_checkudata(L, 1, BUFFER_MT);
+	size_t len;
+	size_t idx = luaL_checkinteger(L, 2);
+	const char *str = luaL_checklstring(L, 3, &len);
+	if ((idx < 1) || (idx > b->size + 1)) LERR("out of range");
+	if (len > b->size - idx + 1) LERR("out of range");
+	memcpy(b->p + idx - 1, str, len);
+	RET_TRUE;
+}
+
+
 //----------------------------------------------------------------------
 // directories, filesystem 
 
@@ -557,6 +1291,18 @@ static int ll_ioctl_int(lua_State *L) {
 	return int_or_errno(L, ioctl(fd, cmd, arg));
 }
 
+static int ll_ioctl_buf(lua_State *L) {
+	// lua api:  ioctl_buf(fd, cmd, b) => r | nil, errno
+	// same as ioctl() but the argument is a buffer which is used
+	// in place, so there is no limit on the argument size.
+	// the ioctl result is in the buffer.
+	int fd = luaL_checkinteger(L, 1);
+	int cmd = luaL_checkinteger(L, 2);
+	l5buf *b = luaL_checkudata(L, 3, BUFFER_MT);
+	if (b->p == NULL) LERR("ioctl_buf: buffer is freed");
+	return int_or_errno(L, ioctl(fd, cmd, b->p));
+}
+
 static int ll_poll(lua_State *L) {
 	// lua api: poll(pollfdlist, timeout) => n | nil, errno
 	// pollfdlist: a list of struct pollfd stored as lua integers
@@ -615,6 +1361,889 @@ static int ll_pollin(lua_State *L) {
 	return int_or_errno(L, poll(&pfd, (nfds_t) 1, timeout));
 }
 
+//----------------------------------------------------------------------
+// inotify
+
+#define INOTIFY_BUFSIZE 65536
+
+static int ll_inotify_init(lua_State *L) {
+	// lua api: inotify_init([flags]) => fd | nil, errno
+	// flags is an OR of IN_NONBLOCK (0x800) and IN_CLOEXEC (0x80000)
+	// flags defaults to 0
+	int flags = luaL_optinteger(L, 1, 0);
+	return int_or_errno(L, inotify_init1(flags));
+}
+
+static int ll_inotify_add_watch(lua_State *L) {
+	// lua api: inotify_add_watch(fd, path, mask) => wd | nil, errno
+	int fd = luaL_checkinteger(L, 1);
+	const char *pname = luaL_checkstring(L, 2);
+	uint32_t mask = luaL_checkinteger(L, 3);
+	return int_or_errno(L, inotify_add_watch(fd, pname, mask));
+}
+
+static int ll_inotify_rm_watch(lua_State *L) {
+	// lua api: inotify_rm_watch(fd, wd) => 0 | nil, errno
+	int fd = luaL_checkinteger(L, 1);
+	int wd = luaL_checkinteger(L, 2);
+	return int_or_errno(L, inotify_rm_watch(fd, wd));
+}
+
+static int ll_inotify_read(lua_State *L) {
+	// lua api: inotify_read(fd) => evlist | nil, errno
+	// read all the available events at once (up to 64 kbytes) and
+	// decode them. evlist is a list of events. Each event is a list
+	// { wd, mask, cookie, name }. name is the name of the file 
+	// in the watched directory or nil for an event on the watched
+	// object itself.
+	int fd = luaL_checkinteger(L, 1);
+	char *buf = malloc(INOTIFY_BUFSIZE);
+	const struct inotify_event *ev;
+	ssize_t n;
+	size_t i;
+	int cnt = 0;
+	if (buf == NULL) LERR("inotify_read: out of memory");
+	do n = read(fd, buf, INOTIFY_BUFSIZE);
+	while (n == -1 && errno == EINTR);
+	if (n == -1) {
+		free(buf);
+		return nil_errno(L);
+	}
+	lua_newtable(L);
+	for (i = 0; i + sizeof(struct inotify_event) <= (size_t)n; 
+			i += sizeof(struct inotify_event) + ev->len) {
+		ev = (const struct inotify_event *)(buf + i);
+		lua_createtable(L, 4, 0);
+		lua_pushinteger(L, ev->wd); lua_rawseti(L, -2, 1);
+		lua_pushinteger(L, ev->mask); lua_rawseti(L, -2, 2);
+		lua_pushinteger(L, ev->cookie); lua_rawseti(L, -2, 3);
+		if (ev->len > 0) {
+			// name is null-padded
+			lua_pushstring(L, ev->name); 
+			lua_rawseti(L, -2, 4);
+		}
+		lua_rawseti(L, -2, ++cnt);
+	}
+	free(buf);
+	return 1;
+}
+
+//----------------------------------------------------------------------
+// buffered stream reader
+//
+// a reader is a full userdata bound to a fd (usually a stream socket or
+// a pipe) with an input buffer. Delimiters are found with memchr() or
+// memmem() and only the extracted slices are returned as Lua strings.
+// The part of the buffer already scanned is remembered, so that a long
+// line received in many fragments is scanned only once.
+// The buffer is contiguous: consumed bytes are dropped by moving the
+// remaining bytes to the beginning of the buffer when more room is
+// needed. It grows as needed up to maxsize bytes, and shrinks back to 
+// its initial size when it is empty.
+// 
+// Read functions return nil, errno on error. For a non-blocking fd,
+// errno is EAGAIN when more input is needed (buffered bytes are kept).
+// At end of file, they return nil, EOF (0x10000 - same as sock.EOF)
+
+#define READER_MT "l5_reader"
+#define L5_EOF 0x10000
+
+typedef struct reader {
+	int fd;
+	char *p;		// buffer
+	size_t cap;		// buffer size
+	size_t size0;		// initial buffer size
+	size_t maxsize;		// max buffer size
+	size_t start;		// index of first unread byte
+	size_t end;		// index after last buffered byte
+	size_t scanned;		// unread bytes already scanned for a delim
+} reader;
+
+static reader *checkreader(lua_State *L, int i) {
+	reader *r = luaL_checkudata(L, i, READER_MT);
+	if (r->p == NULL) luaL_error(L, "reader is freed");
+	return r;
+}
+
+static int rdr_fill(reader *r) {
+	// read more bytes from fd into the buffer
+	// return number of bytes read (0 at EOF) or -1 (errno is set)
+	ssize_t n;
+	size_t ncap;
+	char *np;
+	if (r->end == r->cap) {
+		if (r->start > 0) { // drop consumed bytes
+			memmove(r->p, r->p + r->start, r->end - r->start);
+			r->end -= r->start;
+			r->start = 0;
+		} else { // grow
+			if (r->cap >= r->maxsize) { errno = ENOBUFS; return -1; }
+			ncap = r->cap * 2;
+			if (ncap > r->maxsize) ncap = r->maxsize;
+			np = realloc(r->p, ncap);
+			if (np == NULL) { errno = ENOMEM; return -1; }
+			r->p = np;
+			r->cap = ncap;
+		}
+	}
+	do n = read(r->fd, r->p + r->end, r->cap - r->end);
+	while (n == -1 && errno == EINTR);
+	if (n > 0) r->end += n;
+	return n;
+}
+
+static void rdr_consume(reader *r, size_t n) {
+	// drop n bytes at the beginning of the unread bytes
+	char *np;
+	r->start += n;
+	r->scanned = 0;
+	if (r->start < r->end) return;
+	r->start = r->end = 0;
+	if (r->cap > r->size0) { // shrink back an empty buffer
+		np = realloc(r->p, r->size0);
+		if (np != NULL) { r->p = np; r->cap = r->size0; }
+	}
+}
+
+static int rdr_error(lua_State *L, int n) {
+	// return nil, EOF (if n == 0) or nil, errno
+	if (n == 0) RET_ERRINT(L5_EOF);
+	return nil_errno(L);
+}
+
+static int ll_rdr_new(lua_State *L) {
+	// lua api: rdr_new(fd [, bufsize, maxsize]) => reader
+	// bufsize is the initial buffer size (defaults to 16 kbytes)
+	// maxsize is the max buffer size (defaults to 64 mbytes). It is
+	// the max size of a line, of a readbytes() or a frame.
+	int fd = luaL_checkinteger(L, 1);
+	size_t size = luaL_optinteger(L, 2, 4 * BUFSIZE);
+	size_t maxsize = luaL_optinteger(L, 3, 64 * 1024 * 1024);
+	if (size < 16) size = 16;
+	if (maxsize < size) maxsize = size;
+	reader *r = lua_newuserdata(L, sizeof(reader));
+	memset(r, 0, sizeof(reader));
+	luaL_getmetatable(L, READER_MT);
+	lua_setmetatable(L, -2);
+	r->p = malloc(size);
+	if (r->p == NULL) LERR("rdr_new: out of memory");
+	r->fd = fd;
+	r->cap = r->size0 = size;
+	r->maxsize = maxsize;
+	return 1;
+}
+
+static int ll_rdr_free(lua_State *L) {
+	// lua api: rdr_free(reader)
+	// release the reader buffer (the fd is not closed)
+	// (this is also the reader __gc metamethod)
+	reader *r = luaL_checkudata(L, 1, READER_MT);
+	free(r->p);
+	r->p = NULL;
+	r->start = r->end = r->cap = 0;
+	RET_TRUE;
+}
+
+static int ll_rdr_buffered(lua_State *L) {
+	// lua api: rdr_buffered(reader) => n
+	// return the number of buffered bytes not yet read.
+	// (in an event loop, buffered bytes must be processed before 
+	// polling the fd again)
+	reader *r = checkreader(L, 1);
+	RET_INT(r->end - r->start);
+}
+
+static int ll_rdr_read(lua_State *L) {
+	// lua api: rdr_read(reader) => str | nil, errno
+	// return all the buffered bytes. if the buffer is empty, 
+	// read() once from the fd.
+	reader *r = checkreader(L, 1);
+	int n;
+	size_t len;
+	if (r->start == r->end) {
+		n = rdr_fill(r);
+		if (n <= 0) return rdr_error(L, n);
+	}
+	len = r->end - r->start;
+	lua_pushlstring(L, r->p + r->start, len);
+	rdr_consume(r, len);
+	return 1;
+}
+
+static int ll_rdr_readline(lua_State *L) {
+	// lua api: rdr_readline(reader) => line | nil, errno
+	// return a line without the end of line ("\n" or "\r\n")
+	// (at EOF, an incomplete last line is kept in the buffer. 
+	// it can be read with rdr_read())
+	reader *r = checkreader(L, 1);
+	char *q;
+	size_t len;
+	int n;
+	while (1) {
+		q = memchr(r->p + r->start + r->scanned, '\n', 
+			r->end - r->start - r->scanned);
+		if (q != NULL) break;
+		r->scanned = r->end - r->start;
+		n = rdr_fill(r);
+		if (n <= 0) return rdr_error(L, n);
+	}
+	len = q - (r->p + r->start);
+	if (len > 0 && q[-1] == '\r') 
+		lua_pushlstring(L, r->p + r->start, len - 1);
+	else 
+		lua_pushlstring(L, r->p + r->start, len);
+	rdr_consume(r, len + 1);
+	return 1;
+}
+
+static int ll_rdr_readuntil(lua_State *L) {
+	// lua api: rdr_readuntil(reader, delim) => str | nil, errno
+	// return the bytes before the delimiter string delim. 
+	// the delimiter is consumed but not returned.
+	reader *r = checkreader(L, 1);
+	size_t dlen, from, len;
+	const char *delim = luaL_checklstring(L, 2, &dlen);
+	char *q;
+	int n;
+	if (dlen == 0) LERR("rdr_readuntil: empty delimiter");
+	while (1) {
+		// a delimiter may straddle the already scanned part
+		from = (r->scanned >= dlen) ? r->scanned - dlen + 1 : 0;
+		q = memmem(r->p + r->start + from, r->end - r->start - from,
+			delim, dlen);
+		if (q != NULL) break;
+		r->scanned = r->end - r->start;
+		n = rdr_fill(r);
+		if (n <= 0) return rdr_error(L, n);
+	}
+	len = q - (r->p + r->start);
+	lua_pushlstring(L, r->p + r->start, len);
+	rdr_consume(r, len + dlen);
+	return 1;
+}
+
+static int ll_rdr_readbytes(lua_State *L) {
+	// lua api: rdr_readbytes(reader, n) => str | nil, errno
+	// return n bytes. At EOF, if less than n bytes are available,
+	// they are returned. If none, return nil, EOF
+	reader *r = checkreader(L, 1);
+	size_t cnt = luaL_checkinteger(L, 2);
+	size_t len;
+	int n;
+	while (r->end - r->start < cnt) {
+		n = rdr_fill(r);
+		if (n == 0 && r->end > r->start) break;
+		if (n <= 0) return rdr_error(L, n);
+	}
+	len = r->end - r->start;
+	if (len > cnt) len = cnt;
+	lua_pushlstring(L, r->p + r->start, len);
+	rdr_consume(r, len);
+	return 1;
+}
+
+static int ll_rdr_readframe(lua_State *L) {
+	// lua api: rdr_readframe(reader [, hlen, le]) => str | nil, errno
+	// read a length-prefixed frame and return its payload.
+	// hlen is the size of the length header: 1, 2, 4 or 8 bytes
+	// (defaults to 4). The length is an unsigned integer, big-endian 
+	// unless le is true. It is the payload length (not including 
+	// the header). If the payload is larger than the reader maxsize,
+	// return nil, EMSGSIZE
+	reader *r = checkreader(L, 1);
+	size_t hlen = luaL_optinteger(L, 2, 4);
+	int le = lua_toboolean(L, 3);
+	uint64_t plen = 0;
+	size_t i;
+	unsigned char *h;
+	int n;
+	if (hlen != 1 && hlen != 2 && hlen != 4 && hlen != 8) 
+		LERR("rdr_readframe: invalid header length");
+	while (r->end - r->start < hlen) {
+		n = rdr_fill(r);
+		if (n <= 0) return rdr_error(L, n);
+	}
+	h = (unsigned char *)r->p + r->start;
+	for (i = 0; i < hlen; i++) {
+		if (le) plen |= (uint64_t)h[i] << (8 * i);
+		else plen = (plen << 8) | h[i];
+	}
+	if (plen > r->maxsize - hlen) RET_ERRINT(EMSGSIZE);
+	while (r->end - r->start < hlen + plen) {
+		n = rdr_fill(r);
+		if (n <= 0) return rdr_error(L, n);
+	}
+	lua_pushlstring(L, r->p + r->start + hlen, plen);
+	rdr_consume(r, hlen + plen);
+	return 1;
+}
+
+//----------------------------------------------------------------------
+// terminal - key decoding and double-buffered screen
+//
+// a terminal object is a full userdata bound to an input fd (in raw
+// mode - see l5/tty.lua) and an output fd.
+//
+// input: term_readkeys() reads the available input and decodes it
+// into keys (see ll_term_readkeys() below). Incomplete escape 
+// sequences and UTF-8 characters are kept until the next read.
+//
+// output: the screen is a grid of cells. Frames are drawn in a back
+// buffer with term_clear() and term_put(). term_flush() compares the
+// back buffer with the front buffer (what is on the screen), and 
+// sends the escape sequences and characters needed to update only 
+// the changed cells, in one write().
+//
+// a cell character is stored as its UTF-8 bytes packed in an uint32
+// (first byte in the low byte). Each character is assumed to use one
+// column (double-width characters are not supported).
+//
+// cell attributes (see tty.attr() in l5/tty.lua):
+//	bits 0-8: foreground color (0=default, n=color n-1, 256 colors)
+//	bits 9-17: background color (same encoding)
+//	bit 18: bold, bit 19: underline, bit 20: reverse
+
+#define TERM_MT "l5_term"
+#define TERM_INBUFSIZE 4096
+
+#define TA_BOLD (1 << 18)
+#define TA_UNDERLINE (1 << 19)
+#define TA_REVERSE (1 << 20)
+
+typedef struct tcell {
+	uint32_t ch;
+	uint32_t attr;
+} tcell;
+
+typedef struct term {
+	int infd, outfd;
+	int rows, cols;
+	tcell *front;		// what is on the screen
+	tcell *back;		// the frame being drawn
+	int full;		// redraw all cells at next flush
+	int crow, ccol;		// cursor position after flush (0: hidden)
+	char in[TERM_INBUFSIZE]; // unprocessed input bytes
+	size_t inlen;
+	int inpaste;		// in a bracketed paste
+	char *paste;		// bracketed paste content
+	size_t pastelen, pastecap;
+	char *out;		// output buffer
+	size_t outlen, outcap;
+	int oom;		// out of memory while building output
+} term;
+
+static term *checkterm(lua_State *L, int i) {
+	term *t = luaL_checkudata(L, i, TERM_MT);
+	if (t->front == NULL) luaL_error(L, "terminal is freed");
+	return t;
+}
+
+static int term_alloc(term *t, int rows, int cols) {
+	// (re)allocate the screen buffers. return 0 or -1
+	size_t i, n = (size_t)rows * cols;
+	tcell *f = malloc(n * sizeof(tcell) + 1);
+	tcell *b = malloc(n * sizeof(tcell) + 1);
+	if (f == NULL || b == NULL) { free(f); free(b); return -1; }
+	free(t->front);
+	free(t->back);
+	t->front = f;
+	t->back = b;
+	t->rows = rows;
+	t->cols = cols;
+	for (i = 0; i < n; i++) {
+		b[i].ch = f[i].ch = ' ';
+		b[i].attr = f[i].attr = 0;
+	}
+	t->full = 1;
+	return 0;
+}
+
+static int ll_term_free(lua_State *L) {
+	// lua api: term_free(t)
+	// (this is also the terminal __gc metamethod)
+	term *t = luaL_checkudata(L, 1, TERM_MT);
+	free(t->front);
+	free(t->back);
+	free(t->paste);
+	free(t->out);
+	t->front = t->back = NULL;
+	t->paste = t->out = NULL;
+	RET_TRUE;
+}
+
+static int ll_term_new(lua_State *L) {
+	// lua api: term_new(infd, outfd, rows, cols) => t
+	int infd = luaL_checkinteger(L, 1);
+	int outfd = luaL_checkinteger(L, 2);
+	int rows = luaL_checkinteger(L, 3);
+	int cols = luaL_checkinteger(L, 4);
+	if (rows < 1 || cols < 1 || rows > 4096 || cols > 4096) 
+		LERR("out of range");
+	term *t = lua_newuserdata(L, sizeof(term));
+	memset(t, 0, sizeof(term));
+	luaL_getmetatable(L, TERM_MT);
+	lua_setmetatable(L, -2);
+	if (term_alloc(t, rows, cols) == -1) LERR("term_new: out of memory");
+	t->infd = infd;
+	t->outfd = outfd;
+	return 1;
+}
+
+static int ll_term_resize(lua_State *L) {
+	// lua api: term_resize(t, rows, cols)
+	// the screen is cleared and fully redrawn at the next flush
+	term *t = checkterm(L, 1);
+	int rows = luaL_checkinteger(L, 2);
+	int cols = luaL_checkinteger(L, 3);
+	if (rows < 1 || cols < 1 || rows > 4096 || cols > 4096) 
+		LERR("out of range");
+	if (term_alloc(t, rows, cols) == -1) LERR("term_resize: out of memory");
+	RET_TRUE;
+}
+
+static int ll_term_invalidate(lua_State *L) {
+	// lua api: term_invalidate(t)
+	// force a full redraw at the next flush (eg. if the screen
+	// has been modified by another program)
+	term *t = checkterm(L, 1);
+	t->full = 1;
+	RET_TRUE;
+}
+
+static int ll_term_clear(lua_State *L) {
+	// lua api: term_clear(t [, attr])
+	// clear the back buffer (fill it with spaces)
+	term *t = checkterm(L, 1);
+	uint32_t attr = luaL_optinteger(L, 2, 0);
+	size_t i, n = (size_t)t->rows * t->cols;
+	for (i = 0; i < n; i++) {
+		t->back[i].ch = ' ';
+		t->back[i].attr = attr;
+	}
+	RET_TRUE;
+}
+
+static int ll_term_put(lua_State *L) {
+	// lua api: term_put(t, row, col, str [, attr]) => col
+	// write the UTF-8 string str in the back buffer at position 
+	// row, col (1-based), with attribute attr (defaults to 0).
+	// the string is clipped at the end of the row. control chars
+	// and invalid UTF-8 bytes are displayed as '?'.
+	// return the column after the last written character
+	term *t = checkterm(L, 1);
+	int row = luaL_checkinteger(L, 2);
+	int col = luaL_checkinteger(L, 3);
+	size_t len, i = 0, j, clen;
+	const unsigned char *s = 
+		(const unsigned char *)luaL_checklstring(L, 4, &len);
+	uint32_t attr = luaL_optinteger(L, 5, 0);
+	uint32_t ch;
+	tcell *c;
+	if (row < 1 || row > t->rows) RET_INT(col);
+	while (i < len && col <= t->cols) {
+		if (s[i] < 0x80) clen = 1;
+		else if ((s[i] & 0xe0) == 0xc0) clen = 2;
+		else if ((s[i] & 0xf0) == 0xe0) clen = 3;
+		else if ((s[i] & 0xf8) == 0xf0) clen = 4;
+		else clen = 0; // invalid lead byte
+		for (j = 1; j < clen; j++) 
+			if (i + j >= len || (s[i + j] & 0xc0) != 0x80) clen = 0;
+		if (clen == 0 || s[i] < 0x20 || s[i] == 0x7f) {
+			ch = '?';
+			if (clen == 0) clen = 1;
+		} else {
+			for (ch = 0, j = 0; j < clen; j++) 
+				ch |= (uint32_t)s[i + j] << (8 * j);
+		}
+		if (col >= 1) {
+			c = t->back + (size_t)(row - 1) * t->cols + col - 1;
+			c->ch = ch;
+			c->attr = attr;
+		}
+		i += clen;
+		col += 1;
+	}
+	RET_INT(col);
+}
+
+static int ll_term_cursor(lua_State *L) {
+	// lua api: term_cursor(t, row, col)
+	// set the cursor position after the next flushes
+	// if row is 0, the cursor is hidden
+	term *t = checkterm(L, 1);
+	t->crow = luaL_checkinteger(L, 2);
+	t->ccol = luaL_optinteger(L, 3, 1);
+	RET_TRUE;
+}
+
+static void tout(term *t, const char *s, size_t n) {
+	// append to the output buffer
+	char *p;
+	size_t cap;
+	if (t->outlen + n > t->outcap) {
+		cap = t->outcap * 2 + n + 1024;
+		p = realloc(t->out, cap);
+		if (p == NULL) { t->oom = 1; return; }
+		t->out = p;
+		t->outcap = cap;
+	}
+	memcpy(t->out + t->outlen, s, n);
+	t->outlen += n;
+}
+
+static void tsgr(term *t, uint32_t attr) {
+	// append the SGR sequence for a cell attribute
+	char buf[64];
+	int n;
+	uint32_t fg = attr & 0x1ff, bg = (attr >> 9) & 0x1ff;
+	n = sprintf(buf, "\x1b[0%s%s%s", 
+		(attr & TA_BOLD) ? ";1" : "", 
+		(attr & TA_UNDERLINE) ? ";4" : "", 
+		(attr & TA_REVERSE) ? ";7" : "");
+	if (fg) n += sprintf(buf + n, ";38;5;%u", fg - 1);
+	if (bg) n += sprintf(buf + n, ";48;5;%u", bg - 1);
+	buf[n++] = 'm';
+	tout(t, buf, n);
+}
+
+static int ll_term_flush(lua_State *L) {
+	// lua api: term_flush(t) => n | nil, errno
+	// update the screen with the changes in the back buffer since 
+	// the last flush, in one write(). 
+	// return the number of bytes written
+	term *t = checkterm(L, 1);
+	char buf[32];
+	int row, col, n, crow = 0, ccol = 0; // crow=0: unknown position
+	uint32_t attr = 0xffffffff; // unknown current attribute
+	uint32_t ch;
+	size_t k;
+	tcell *f, *b;
+	t->outlen = 0;
+	t->oom = 0;
+	tout(t, "\x1b[?25l", 6); // hide the cursor while drawing
+	if (t->full) tout(t, "\x1b[0m\x1b[2J", 8);
+	for (row = 1; row <= t->rows; row++) {
+		for (col = 1; col <= t->cols; col++) {
+			k = (size_t)(row - 1) * t->cols + col - 1;
+			f = t->front + k;
+			b = t->back + k;
+			if (!t->full && f->ch == b->ch && f->attr == b->attr)
+				continue;
+			if (t->full && b->ch == ' ' && b->attr == 0) 
+				continue; // the screen has been cleared
+			if (row != crow || col != ccol) {
+				n = sprintf(buf, "\x1b[%d;%dH", row, col);
+				tout(t, buf, n);
+			}
+			if (b->attr != attr) {
+				tsgr(t, b->attr);
+				attr = b->attr;
+			}
+			for (ch = b->ch; ch != 0; ch >>= 8) {
+				buf[0] = ch & 0xff;
+				tout(t, buf, 1);
+			}
+			*f = *b;
+			crow = row;
+			ccol = col + 1;
+			// after the last column, the cursor position
+			// depends on the terminal (pending wrap)
+			if (ccol > t->cols) crow = 0;
+		}
+	}
+	if (t->full) memcpy(t->front, t->back, 
+		(size_t)t->rows * t->cols * sizeof(tcell));
+	tout(t, "\x1b[0m", 4);
+	if (t->crow > 0) {
+		n = sprintf(buf, "\x1b[%d;%dH\x1b[?25h", t->crow, t->ccol);
+		tout(t, buf, n);
+	}
+	if (t->oom) {
+		t->full = 1;
+		LERR("term_flush: out of memory");
+	}
+	t->full = 0;
+	if (writeall(t->outfd, t->out, t->outlen) == -1) {
+		t->full = 1; // the screen state is unknown
+		return nil_errno(L);
+	}
+	RET_INT(t->outlen);
+}
+
+static const char *tkey_tilde(int n) {
+	// key names for "ESC [ n ~" sequences
+	switch (n) {
+		case 1: case 7: return "home";
+		case 2: return "ins";
+		case 3: return "del";
+		case 4: case 8: return "end";
+		case 5: return "pgup";
+		case 6: return "pgdn";
+		case 11: return "f1"; case 12: return "f2";
+		case 13: return "f3"; case 14: return "f4";
+		case 15: return "f5"; case 17: return "f6";
+		case 18: return "f7"; case 19: return "f8";
+		case 20: return "f9"; case 21: return "f10";
+		case 23: return "f11"; case 24: return "f12";
+	}
+	return NULL;
+}
+
+static const char *tkey_final(int c) {
+	// key names for "ESC [ x" and "ESC O x" sequences
+	switch (c) {
+		case 'A': return "up";
+		case 'B': return "down";
+		case 'C': return "right";
+		case 'D': return "left";
+		case 'H': return "home";
+		case 'F': return "end";
+		case 'Z': return "btab";
+		case 'P': return "f1";
+		case 'Q': return "f2";
+		case 'R': return "f3";
+		case 'S': return "f4";
+	}
+	return NULL;
+}
+
+static void tkey_push(lua_State *L, int *nk, const char *name, int mod) {
+	// push a key name with an optional xterm modifier parameter
+	// (2=shift, 3=alt, 5=ctrl, ... => "S-", "M-", "C-" prefixes)
+	char buf[32];
+	mod = (mod > 1) ? mod - 1 : 0;
+	snprintf(buf, sizeof(buf), "%s%s%s%s", 
+		(mod & 4) ? "C-" : "", (mod & 2) ? "M-" : "", 
+		(mod & 1) ? "S-" : "", name);
+	lua_pushstring(L, buf);
+	lua_rawseti(L, -2, ++*nk);
+}
+
+static int tpaste_add(term *t, const char *s, size_t n) {
+	char *p;
+	size_t cap;
+	if (t->pastelen + n > t->pastecap) {
+		cap = t->pastecap * 2 + n + 256;
+		p = realloc(t->paste, cap);
+		if (p == NULL) return -1;
+		t->paste = p;
+		t->pastecap = cap;
+	}
+	memcpy(t->paste + t->pastelen, s, n);
+	t->pastelen += n;
+	return 0;
+}
+
+static size_t tdecode(lua_State *L, term *t, int *nk, int final) {
+	// decode keys in the input buffer. push them in the table at
+	// the top of the stack.
+	// if final is true, incomplete sequences are decoded anyway
+	// (eg. a lone ESC is the Escape key)
+	// return the number of bytes consumed
+	unsigned char *s = (unsigned char *)t->in;
+	size_t len = t->inlen, i = 0, j, k;
+	int c, n, mod;
+	const char *name;
+	char buf[8];
+	while (i < len) {
+		if (t->inpaste) {
+			// collect bytes until the end of paste "ESC[201~"
+			for (j = i; j < len; j++) {
+				if (s[j] != 0x1b) continue;
+				if (len - j < 6) break;
+				if (memcmp(s + j, "\x1b[201~", 6) == 0) break;
+			}
+			if (tpaste_add(t, (char *)s + i, j - i) == -1)
+				luaL_error(L, "term_readkeys: out of memory");
+			i = j;
+			if (len - i >= 6) { // end of paste
+				i += 6;
+				t->inpaste = 0;
+				lua_createtable(L, 2, 0);
+				lua_pushstring(L, "paste");
+				lua_rawseti(L, -2, 1);
+				lua_pushlstring(L, t->paste, t->pastelen);
+				lua_rawseti(L, -2, 2);
+				lua_rawseti(L, -2, ++*nk);
+				t->pastelen = 0;
+			} else { // keep a possibly incomplete end marker
+				break;
+			}
+			continue;
+		}
+		c = s[i];
+		if (c == 0x1b) {
+			if (i + 1 >= len) {
+				if (!final) break;
+				tkey_push(L, nk, "esc", 0);
+				i += 1;
+				continue;
+			}
+			if (s[i+1] == '[') { // CSI: ESC [ params final
+				for (j = i + 2; j < len; j++)
+					if (s[j] >= 0x40 && s[j] <= 0x7e) break;
+				if (j >= len) {
+					if (!final) break;
+					// incomplete: ESC is the escape key
+					tkey_push(L, nk, "esc", 0);
+					i += 1;
+					continue;
+				}
+				// params: "n" or "n;mod"
+				n = 0; mod = 0;
+				for (k = i + 2; k < j && s[k] != ';'; k++)
+					if (s[k] >= '0' && s[k] <= '9')
+						n = n * 10 + s[k] - '0';
+				if (k < j) 
+					for (k++; k < j; k++)
+						if (s[k] >= '0' && s[k] <= '9')
+							mod = mod * 10 + s[k] - '0';
+				name = NULL;
+				if (s[j] == '~') {
+					if (n == 200) t->inpaste = 1;
+					else name = tkey_tilde(n);
+				} else {
+					name = tkey_final(s[j]);
+				}
+				// unknown sequences are ignored
+				if (name) tkey_push(L, nk, name, mod);
+				i = j + 1;
+				continue;
+			}
+			if (s[i+1] == 'O') { // SS3: ESC O x
+				if (i + 2 >= len) {
+					if (!final) break;
+					tkey_push(L, nk, "esc", 0);
+					i += 1;
+					continue;
+				}
+				name = tkey_final(s[i+2]);
+				if (name) tkey_push(L, nk, name, 0);
+				i += 3;
+				continue;
+			}
+			// ESC x: alt-x => "M-x"
+			c = s[i+1];
+			if (c >= 0x20 && c < 0x7f) {
+				buf[0] = c; buf[1] = 0;
+				tkey_push(L, nk, buf, 3);
+				i += 2;
+				continue;
+			}
+			tkey_push(L, nk, "esc", 0);
+			i += 1;
+			continue;
+		}
+		if (c == 0x0d || c == 0x0a) name = "enter";
+		else if (c == 0x09) name = "tab";
+		else if (c == 0x7f || c == 0x08) name = "backspace";
+		else name = NULL;
+		if (name) {
+			tkey_push(L, nk, name, 0);
+			i += 1;
+			continue;
+		}
+		if (c < 0x20) { // ctrl keys: "C-a", ...
+			buf[0] = (c == 0) ? '@' : (c <= 26) ? c + 0x60 : c + 0x40;
+			buf[1] = 0;
+			tkey_push(L, nk, buf, 5);
+			i += 1;
+			continue;
+		}
+		// printable. return UTF-8 characters as one key
+		if (c < 0x80) n = 1;
+		else if ((c & 0xe0) == 0xc0) n = 2;
+		else if ((c & 0xf0) == 0xe0) n = 3;
+		else if ((c & 0xf8) == 0xf0) n = 4;
+		else n = 1; // invalid lead byte. return it as is
+		if (i + n > len) {
+			if (!final) break;
+			n = len - i;
+		}
+		lua_pushlstring(L, (char *)s + i, n);
+		lua_rawseti(L, -2, ++*nk);
+		i += n;
+	}
+	return i;
+}
+
+static int ll_term_readkeys(lua_State *L) {
+	// lua api: term_readkeys(t) => keylist | nil, errno
+	// read the available input and return the list of decoded keys
+	// (possibly empty). Keys are strings:
+	//   - a printable character (UTF-8 encoded), eg. "a", "é"
+	//   - a key name: "enter", "tab", "backspace", "esc", "up", 
+	//     "down", "right", "left", "home", "end", "pgup", "pgdn",
+	//     "ins", "del", "btab", "f1" ... "f12"
+	//   - control or alt keys, and key names with modifiers, are 
+	//     prefixed with "C-", "M-", "S-" eg. "C-a", "M-x", "C-up"
+	// a bracketed paste is returned as one key: { "paste", text }
+	// 
+	// the input fd should be non-blocking (or in raw mode with 
+	// VMIN=0 - see tty.setrawmode(true)). An incomplete escape 
+	// sequence at the end of the input is kept until the next call.
+	// If no more input is available then, it is decoded anyway 
+	// (eg. a lone ESC is the Escape key).
+	term *t = checkterm(L, 1);
+	ssize_t n;
+	size_t used;
+	int nk = 0;
+	do n = read(t->infd, t->in + t->inlen, TERM_INBUFSIZE - t->inlen);
+	while (n == -1 && errno == EINTR);
+	if (n == -1 && errno != EAGAIN) return nil_errno(L);
+	if (n > 0) t->inlen += n;
+	lua_newtable(L);
+	used = tdecode(L, t, &nk, n <= 0 || t->inlen == TERM_INBUFSIZE);
+	memmove(t->in, t->in + used, t->inlen - used);
+	t->inlen -= used;
+	return 1;
+}
+
+static int winch_pipe[2] = { -1, -1 };
+
+static void winch_handler(int sig) {
+	int eno = errno;
+	write(winch_pipe[1], "w", 1);
+	errno = eno;
+}
+
+static int ll_term_winchfd(lua_State *L) {
+	// lua api: term_winchfd() => fd | nil, errno
+	// install a SIGWINCH handler and return a fd which is readable
+	// (POLLIN) when the terminal has been resized. The fd is 
+	// non-blocking. It should be drained with read() before getting
+	// the new size with term_getsize().
+	// (the handler is installed only once. Later calls return
+	// the same fd)
+	struct sigaction sa;
+	if (winch_pipe[0] != -1) RET_INT(winch_pipe[0]);
+	if (pipe2(winch_pipe, O_NONBLOCK | O_CLOEXEC) == -1) 
+		return nil_errno(L);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = winch_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGWINCH, &sa, NULL) == -1) {
+		int eno = errno;
+		close(winch_pipe[0]); close(winch_pipe[1]);
+		winch_pipe[0] = winch_pipe[1] = -1;
+		errno = eno;
+		return nil_errno(L);
+	}
+	RET_INT(winch_pipe[0]);
+}
+
+static int ll_term_getsize(lua_State *L) {
+	// lua api: term_getsize([fd]) => rows, cols | nil, errno
+	// fd is a terminal fd (defaults to 1)
+	int fd = luaL_optinteger(L, 1, 1);
+	struct winsize ws;
+	if (ioctl(fd, TIOCGWINSZ, &ws) == -1) return nil_errno(L);
+	lua_pushinteger(L, ws.ws_row);
+	lua_pushinteger(L, ws.ws_col);
+	return 2;
+}
+
 //----------------------------------------------------------------------
 // socket functions
 
@@ -636,6 +2265,20 @@ static int ll_setsockopt(lua_State *L) {
 		fd, level, optname, &optvalue, sizeof(optvalue)));
 }
 
+static int ll_getsockopt(lua_State *L) {
+	// lua api: getsockopt(fd, level, optname) => intvalue
+	// (eg. getsockopt(fd, SOL_SOCKET, SO_ERROR) to get the result of
+	// a non-blocking connect)
+	int fd = luaL_checkinteger(L, 1);
+	int level = luaL_checkinteger(L, 2);
+	int optname = luaL_checkinteger(L, 3);
+	int optvalue = 0;
+	socklen_t optlen = sizeof(optvalue);
+	int r = getsockopt(fd, level, optname, &optvalue, &optlen);
+	if (r == -1) return nil_errno(L);
+	RET_INT(optvalue);
+}
+
 // will add a ll_setsockopt_str() to set option with 
 // a non-integer value, if needed.
 // at the moment the only case for a non-integer value is setting 
@@ -700,6 +2343,15 @@ static int ll_connect(lua_State *L) {
 		connect(fd, (const struct sockaddr *)addr, len));
 }
 
+static int ll_shutdown(lua_State *L) {
+	// lua api: shutdown(fd [, how])
+	// how is 0 (SHUT_RD), 1 (SHUT_WR) or 2 (SHUT_RDWR). 
+	// It defaults to SHUT_WR.
+	int fd = luaL_checkinteger(L, 1);
+	int how = luaL_optinteger(L, 2, SHUT_WR);
+	return int_or_errno(L, shutdown(fd, how));
+}
+
 static int ll_recvfrom(lua_State *L) {
 	// lua api: recvfrom(fd [, flags]) => str, sockaddr
 	// receive up to BUFSIZE bytes (4,096 bytes)
@@ -720,61 +2372,269 @@ static int ll_recvfrom(lua_State *L) {
 }
 
 static int ll_recv(lua_State *L) {
-	// lua api: recv(fd [, flags]) => str
-	// receive up to BUFSIZE bytes (4,096 bytes)
+	// lua api: recv(fd [, flags, bufsize]) => str
+	// receive up to bufsize bytes (defaults to BUFSIZE, 4,096 bytes)
 	// return received bytes as a string or nil, errno
 	// flags is an OR of all the MSG_* flags defined in sys/socket.h
 	// flags defaults to 0.
+	// (a larger bufsize is required eg. for netlink dumps where 
+	// a datagram can be larger than BUFSIZE)
 	int fd = luaL_checkinteger(L, 1);
-	char buf[BUFSIZE];
 	int flags = luaL_optinteger(L, 2, 0);
-	int n = recv(fd, buf, BUFSIZE, flags);
+	size_t bufsize = luaL_optinteger(L, 3, BUFSIZE);
+	luaL_Buffer b;
+	char *buf = luaL_buffinitsize(L, &b, bufsize);
+	int n = recv(fd, buf, bufsize, flags);
 	if (n == -1) return nil_errno(L);
-	lua_pushlstring(L, buf, n);
+	luaL_pushresultsize(&b, n);
 	return 1; 
 }
 
+static const char *checksenddata(lua_State *L, int i, size_t *len) {
+	// return the bytes to send: argument i is a string or a buffer 
+	// (see buf_new())
+	l5buf *b = luaL_testudata(L, i, BUFFER_MT);
+	if (b == NULL) return luaL_checklstring(L, i, len);
+	if (b->p == NULL) luaL_error(L, "buffer is freed");
+	*len = b->size;
+	return b->p;
+}
+
 static int ll_sendto(lua_State *L) {
 	// lua api: sendto(fd, str, flags, sockaddr [, idx, count])
 	// attempt to send count bytes in string str starting at index idx, 
 	// to address sockaddr.
+	// str can also be a buffer (see buf_new())
 	// idx nd count are optional. they default to 1 and the number
 	// of remaining bytes in string.
 	// flags is an OR of all the MSG_* flags defined in sys/socket.h
 	// return number of bytes actually sent, or nil, errno
 	size_t len, idx, count, salen;
-	int n;
 	struct sockaddr *sa;
 	int fd = luaL_checkinteger(L, 1);
-	const char *str = luaL_checklstring(L, 2, &len);	
+	const char *str = checksenddata(L, 2, &len);	
 	int flags = luaL_checkinteger(L, 3);
 	sa = (struct sockaddr *)luaL_checklstring(L, 4, &salen);
 	idx = luaL_optinteger(L, 5, 1);
-	count = len + idx - 1;
-	count = luaL_optinteger(L, 6, count);
-	if ((idx < 1) || (idx + count - 1 > len)) LERR("out of range");
-	return int_or_errno(L, sendto(fd, str, len, flags, sa, salen));
+	if ((idx < 1) || (idx > len + 1)) LERR("out of range");
+	count = luaL_optinteger(L, 6, len - idx + 1);
+	if (count > len - idx + 1) LERR("out of range");
+	return int_or_errno(L, 
+		sendto(fd, str + idx - 1, count, flags, sa, salen));
 }
 
 static int ll_send(lua_State *L) {
-	// lua api: sendto(fd, str, flags [, idx, count])
+	// lua api: send(fd, str, flags [, idx, count])
 	// attempt to send count bytes in string str starting at index idx, 
 	// (assume the socket is connected. equivalent to write(), 
 	// but with flags)
+	// str can also be a buffer (see buf_new())
 	// idx and count are optional. they default to 1 and the number
 	// of remaining bytes in string.
 	// flags is an OR of all the MSG_* flags defined in sys/socket.h
+	// with MSG_ZEROCOPY, the bytes are not copied. They must not be 
+	// modified or released until the completion is reported by 
+	// zc_reap().
 	// return number of bytes actually sent, or nil, errno
 	size_t len, idx, count;
-	int n;
 	int fd = luaL_checkinteger(L, 1);
-	const char *str = luaL_checklstring(L, 2, &len);	
+	const char *str = checksenddata(L, 2, &len);	
 	int flags = luaL_checkinteger(L, 3);
 	idx = luaL_optinteger(L, 4, 1);
-	count = len + idx - 1;
-	count = luaL_optinteger(L, 5, count);
-	if ((idx < 1) || (idx + count - 1 > len)) LERR("out of range");
-	return int_or_errno(L, send(fd, str, len, flags));
+	if ((idx < 1) || (idx > len + 1)) LERR("out of range");
+	count = luaL_optinteger(L, 5, len - idx + 1);
+	if (count > len - idx + 1) LERR("out of range");
+	return int_or_errno(L, send(fd, str + idx - 1, count, flags));
+}
+
+static int ll_socketpair(lua_State *L) {
+	// lua api: socketpair(domain, type, protocol) => fd0, fd1
+	// (domain is usually AF_UNIX, 1)
+	int domain = luaL_checkinteger(L, 1);
+	int sotype = luaL_checkinteger(L, 2);
+	int protocol = luaL_optinteger(L, 3, 0);
+	int sv[2];
+	if (socketpair(domain, sotype, protocol, sv) == -1) 
+		return nil_errno(L);
+	lua_pushinteger(L, sv[0]);
+	lua_pushinteger(L, sv[1]);
+	return 2;
+}
+
+#define MAXFDS 64	// max number of fds passed in one message
+
+static int ll_sendmsg(lua_State *L) {
+	// lua api: sendmsg(fd, str, flags [, fdlist, cred]) => n
+	// send string str with ancillary data on a unix socket
+	// fdlist is an optional list of file descriptors to pass to
+	// the peer (SCM_RIGHTS - at most MAXFDS fds).
+	// if cred is true, the process credentials (pid, uid, gid) are 
+	// sent (SCM_CREDENTIALS). The receiver must have set the 
+	// SO_PASSCRED socket option.
+	// str must not be empty for a stream socket (at least one byte
+	// of data must be sent with the ancillary data)
+	// return number of bytes actually sent, or nil, errno
+	size_t len;
+	int fd = luaL_checkinteger(L, 1);
+	const char *str = luaL_checklstring(L, 2, &len);	
+	int flags = luaL_checkinteger(L, 3);
+	int nfd = 0;
+	if (!lua_isnoneornil(L, 4)) {
+		luaL_checktype(L, 4, LUA_TTABLE);
+		nfd = luaL_len(L, 4);
+		if (nfd > MAXFDS) LERR("too many fds");
+	}
+	int cred = lua_toboolean(L, 5);
+	union {	// ensure proper alignment of the control buffer
+		char buf[CMSG_SPACE(MAXFDS * sizeof(int)) 
+			+ CMSG_SPACE(sizeof(struct ucred))];
+		struct cmsghdr align;
+	} u;
+	memset(&u, 0, sizeof(u));
+	struct iovec iov = { .iov_base = (void *)str, .iov_len = len };
+	struct msghdr msg = { 
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = u.buf, .msg_controllen = 0,
+	};
+	msg.msg_controllen = (nfd ? CMSG_SPACE(nfd * sizeof(int)) : 0)
+		+ (cred ? CMSG_SPACE(sizeof(struct ucred)) : 0);
+	if (msg.msg_controllen == 0) msg.msg_control = NULL;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (nfd) {
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfd * sizeof(int));
+		int *fdp = (int *) CMSG_DATA(cmsg);
+		for (int i = 0; i < nfd; i++) {
+			lua_rawgeti(L, 4, i + 1);
+			fdp[i] = luaL_checkinteger(L, -1);
+			lua_pop(L, 1);
+		}
+		cmsg = CMSG_NXTHDR(&msg, cmsg);
+	}
+	if (cred) {
+		struct ucred uc = { 
+			.pid = getpid(), .uid = geteuid(), .gid = getegid() 
+		};
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_CREDENTIALS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+		memcpy(CMSG_DATA(cmsg), &uc, sizeof(uc));
+	}
+	return int_or_errno(L, sendmsg(fd, &msg, flags));
+}
+
+static int ll_recvmsg(lua_State *L) {
+	// lua api: recvmsg(fd [, flags, bufsize]) 
+	//		=> str, fdlist, cred, msgflags
+	// receive up to bufsize bytes (defaults to BUFSIZE, 4,096 bytes)
+	// and the ancillary data sent with them.
+	// fdlist is the list of file descriptors received (SCM_RIGHTS) - 
+	// it is an empty list if no fd has been received. 
+	// flags should include MSG_CMSG_CLOEXEC (0x40000000) to set the 
+	// close-on-exec flag on the received fds.
+	// cred is the sender credentials {pid=, uid=, gid=} 
+	// (SCM_CREDENTIALS) or nil if none has been received
+	// msgflags is the msg_flags field returned by recvmsg(). If it
+	// includes MSG_CTRUNC (8), some fds have been discarded.
+	// return nil, errno in case of error
+	int fd = luaL_checkinteger(L, 1);
+	int flags = luaL_optinteger(L, 2, 0);
+	size_t bufsize = luaL_optinteger(L, 3, BUFSIZE);
+	union {
+		char buf[CMSG_SPACE(MAXFDS * sizeof(int)) 
+			+ CMSG_SPACE(sizeof(struct ucred))];
+		struct cmsghdr align;
+	} u;
+	luaL_Buffer b;
+	char *buf = luaL_buffinitsize(L, &b, bufsize);
+	struct iovec iov = { .iov_base = buf, .iov_len = bufsize };
+	struct msghdr msg = { 
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = u.buf, .msg_controllen = sizeof(u.buf),
+	};
+	int n = recvmsg(fd, &msg, flags);
+	if (n == -1) return nil_errno(L);
+	luaL_pushresultsize(&b, n);
+	lua_newtable(L); // fdlist
+	int k = 0, credfound = 0;
+	struct ucred uc;
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; 
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET) continue;
+		if (cmsg->cmsg_type == SCM_RIGHTS) {
+			int nfd = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			int *fdp = (int *) CMSG_DATA(cmsg);
+			for (int i = 0; i < nfd; i++) {
+				lua_pushinteger(L, fdp[i]);
+				lua_rawseti(L, -2, ++k);
+			}
+		} else if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+			memcpy(&uc, CMSG_DATA(cmsg), sizeof(uc));
+			credfound = 1;
+		}
+	}
+	if (credfound) {
+		lua_createtable(L, 0, 3);
+		lua_pushinteger(L, uc.pid); lua_setfield(L, -2, "pid");
+		lua_pushinteger(L, uc.uid); lua_setfield(L, -2, "uid");
+		lua_pushinteger(L, uc.gid); lua_setfield(L, -2, "gid");
+	} else {
+		lua_pushnil(L);
+	}
+	lua_pushinteger(L, msg.msg_flags);
+	return 4;
+}
+
+static int ll_zc_reap(lua_State *L) {
+	// lua api: zc_reap(fd) => { {lo, hi, copied}, ... } | nil, errno
+	// read the MSG_ZEROCOPY completion notifications in the socket
+	// error queue (the socket is reported with POLLERR when the queue
+	// is not empty). Each successful zerocopy send() on a socket is
+	// numbered by the kernel (0, 1, 2, ... - a 32-bit counter). 
+	// A notification reports that sends lo to hi (inclusive) are 
+	// completed: their bytes can be released. copied is true if the
+	// kernel has copied the bytes anyway (eg. on loopback).
+	// return the list of notifications (empty if none is pending)
+	int fd = luaL_checkinteger(L, 1);
+	char cbuf[CMSG_SPACE(sizeof(struct sock_extended_err) 
+		+ sizeof(struct sockaddr_in6))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct sock_extended_err *ee;
+	int n = 0;
+	lua_newtable(L);
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) break;
+			return nil_errno(L);
+		}
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; 
+				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP 
+				&& cmsg->cmsg_type == IP_RECVERR)
+			    && !(cmsg->cmsg_level == SOL_IPV6 
+				&& cmsg->cmsg_type == IPV6_RECVERR)) continue;
+			ee = (struct sock_extended_err *) CMSG_DATA(cmsg);
+			if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY 
+				|| ee->ee_errno != 0) continue;
+			lua_createtable(L, 3, 0);
+			lua_pushinteger(L, ee->ee_info);
+			lua_rawseti(L, -2, 1);
+			lua_pushinteger(L, ee->ee_data);
+			lua_rawseti(L, -2, 2);
+			lua_pushboolean(L, 
+				ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+			lua_rawseti(L, -2, 3);
+			lua_rawseti(L, -2, ++n);
+		}
+	}
+	return 1;
 }
 
 static int ll_getsockname(lua_State *L) {
@@ -859,9 +2719,746 @@ static int ll_getnameinfo(lua_State *L) {
 }
 
 
+//----------------------------------------------------------------------
+// timer wheel - per-connection deadlines for an event loop
+//
+// a timer wheel is a full userdata holding a large number of timers 
+// with a millisecond resolution on CLOCK_MONOTONIC. Arm, cancel and 
+// re-arm are O(1). It is a hierarchical wheel: TW_LEVELS levels of
+// TW_SLOTS slots. Level 0 slots are 1 ms wide, level 1 slots are 
+// 256 ms wide, etc. A timer is stored in the slot of the lowest 
+// level that can hold its expiration time. When the level 0 index 
+// wraps around, the timers of the next level 1 slot are moved down 
+// ("cascaded") to level 0, and so on. Delays are capped to 2^32 ms
+// (about 49 days).
+// 
+// Timers are nodes in a pool (an array grown as needed). Slots are
+// doubly-linked lists of node indices. A timer id ("tid") is the node
+// index combined with a generation number incremented each time the 
+// node is released, so that a stale tid (an expired or cancelled 
+// timer) is detected and ignored.
+//
+// A bitmap of non-empty slots is maintained for each level, so that 
+// tw_expire() and tw_next() skip empty slots quickly.
+//
+// Each timer holds an integer key (eg. a fd or a connection id) which
+// is returned by tw_expire() when the timer expires.
+
+#define TW_MT "l5_timerwheel"
+#define TW_BITS 8
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+#define TW_MAXDELAY 0xffffffffLL
+
+typedef struct twnode {
+	int64_t expire;		// expiration time in ms
+	lua_Integer key;
+	int next, prev;		// slot list links (-1 for none)
+	int slot;		// level * TW_SLOTS + index, or -1 if free
+	uint32_t gen;		// generation (see tid above)
+} twnode;
+
+typedef struct timerwheel {
+	twnode *nodes;		// node pool (NULL when freed)
+	int cap;		// pool size
+	int freelist;		// first free node (linked with next)
+	int count;		// number of armed timers
+	int64_t now;		// last processed tick (ms)
+	int heads[TW_LEVELS * TW_SLOTS];
+	uint64_t bm[TW_LEVELS][TW_SLOTS / 64];	// non-empty slots
+} timerwheel;
+
+static int64_t tw_clock(void) {
+	// current CLOCK_MONOTONIC time in ms
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static timerwheel *checktw(lua_State *L, int i) {
+	timerwheel *tw = luaL_checkudata(L, i, TW_MT);
+	if (tw->nodes == NULL) luaL_error(L, "timer wheel is freed");
+	return tw;
+}
+
+static void tw_link(timerwheel *tw, int ni) {
+	// insert node ni in the slot matching its expiration time
+	// (when cascading, expire can be equal to now: the node is then
+	// inserted in the level 0 slot about to be processed)
+	twnode *nd = &tw->nodes[ni];
+	int64_t delta = nd->expire - tw->now;
+	int lvl = 0;
+	if (delta > TW_MAXDELAY) {
+		delta = TW_MAXDELAY;
+		nd->expire = tw->now + delta;
+	}
+	while (lvl < TW_LEVELS - 1 
+		&& delta >= ((int64_t)1 << (TW_BITS * (lvl + 1)))) lvl++;
+	int idx = (nd->expire >> (TW_BITS * lvl)) & TW_MASK;
+	int slot = lvl * TW_SLOTS + idx;
+	nd->slot = slot;
+	nd->prev = -1;
+	nd->next = tw->heads[slot];
+	if (nd->next >= 0) tw->nodes[nd->next].prev = ni;
+	tw->heads[slot] = ni;
+	tw->bm[lvl][idx >> 6] |= (uint64_t)1 << (idx & 63);
+}
+
+static void tw_unlink(timerwheel *tw, int ni) {
+	// remove node ni from its slot
+	twnode *nd = &tw->nodes[ni];
+	int slot = nd->slot;
+	if (nd->prev >= 0) tw->nodes[nd->prev].next = nd->next;
+	else tw->heads[slot] = nd->next;
+	if (nd->next >= 0) tw->nodes[nd->next].prev = nd->prev;
+	if (tw->heads[slot] < 0) {
+		int lvl = slot / TW_SLOTS, idx = slot & TW_MASK;
+		tw->bm[lvl][idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+	}
+	nd->slot = -1;
+}
+
+static void tw_release(timerwheel *tw, int ni) {
+	// return an unlinked node to the free list
+	twnode *nd = &tw->nodes[ni];
+	nd->gen++;
+	nd->next = tw->freelist;
+	tw->freelist = ni;
+	tw->count--;
+}
+
+static int tw_nextslot(uint64_t *bm, int from) {
+	// return the first non-empty slot index >= from, or -1
+	int w = from >> 6;
+	uint64_t bits;
+	if (from >= TW_SLOTS) return -1;
+	bits = bm[w] & (~(uint64_t)0 << (from & 63));
+	while (1) {
+		if (bits) return (w << 6) + __builtin_ctzll(bits);
+		if (++w == TW_SLOTS / 64) return -1;
+		bits = bm[w];
+	}
+}
+
+static int64_t tw_deadline(timerwheel *tw, lua_Integer delay) {
+	// return the expiration time of a timer armed now for delay ms
+	// (the tick tw->now has already been processed)
+	int64_t expire = tw_clock() + (delay < 0 ? 0 : delay);
+	return (expire <= tw->now) ? tw->now + 1 : expire;
+}
+
+static int tw_lookup(lua_State *L, timerwheel *tw, int i) {
+	// return the node index of the armed timer tid at index i, 
+	// or -1 if the timer has expired or has been cancelled
+	lua_Integer tid = luaL_checkinteger(L, i);
+	int ni = tid & 0xffffffff;
+	if (ni < 0 || ni >= tw->cap) return -1;
+	twnode *nd = &tw->nodes[ni];
+	if (nd->slot < 0 || nd->gen != (uint32_t)(tid >> 32)) return -1;
+	return ni;
+}
+
+static int ll_tw_new(lua_State *L) {
+	// lua api: tw_new([cap]) => tw
+	// create a timer wheel. cap is the initial node pool size 
+	// (defaults to 1024). The pool grows as needed.
+	int cap = luaL_optinteger(L, 1, 1024);
+	if (cap < 16) cap = 16;
+	timerwheel *tw = lua_newuserdata(L, sizeof(timerwheel));
+	memset(tw, 0, sizeof(timerwheel));
+	luaL_getmetatable(L, TW_MT);
+	lua_setmetatable(L, -2);
+	tw->nodes = calloc(cap, sizeof(twnode));
+	if (tw->nodes == NULL) LERR("tw_new: out of memory");
+	for (int i = 0; i < cap; i++) tw->nodes[i].next = i + 1;
+	tw->nodes[cap - 1].next = -1;
+	for (int i = 0; i < cap; i++) tw->nodes[i].slot = -1;
+	for (int i = 0; i < TW_LEVELS * TW_SLOTS; i++) tw->heads[i] = -1;
+	tw->cap = cap;
+	tw->freelist = 0;
+	tw->now = tw_clock();
+	return 1;
+}
+
+static int ll_tw_free(lua_State *L) {
+	// lua api: tw_free(tw)
+	// release the timer wheel memory 
+	// (this is also the timer wheel __gc metamethod)
+	timerwheel *tw = luaL_checkudata(L, 1, TW_MT);
+	free(tw->nodes);
+	tw->nodes = NULL;
+	tw->cap = tw->count = 0;
+	RET_TRUE;
+}
+
+static int ll_tw_arm(lua_State *L) {
+	// lua api: tw_arm(tw, delay, key) => tid
+	// arm a timer expiring in delay ms. key is an integer returned 
+	// by tw_expire() when the timer expires.
+	// return the timer id
+	timerwheel *tw = checktw(L, 1);
+	lua_Integer delay = luaL_checkinteger(L, 2);
+	lua_Integer key = luaL_checkinteger(L, 3);
+	int ni;
+	if (tw->freelist < 0) { // grow the pool
+		int ncap = tw->cap * 2;
+		twnode *np = realloc(tw->nodes, ncap * sizeof(twnode));
+		if (np == NULL) LERR("tw_arm: out of memory");
+		memset(np + tw->cap, 0, tw->cap * sizeof(twnode));
+		for (int i = tw->cap; i < ncap; i++) {
+			np[i].next = i + 1;
+			np[i].slot = -1;
+		}
+		np[ncap - 1].next = -1;
+		tw->freelist = tw->cap;
+		tw->nodes = np;
+		tw->cap = ncap;
+	}
+	ni = tw->freelist;
+	twnode *nd = &tw->nodes[ni];
+	tw->freelist = nd->next;
+	tw->count++;
+	nd->key = key;
+	nd->expire = tw_deadline(tw, delay);
+	tw_link(tw, ni);
+	RET_INT(((lua_Integer)nd->gen << 32) | ni);
+}
+
+static int ll_tw_rearm(lua_State *L) {
+	// lua api: tw_rearm(tw, tid, delay) => true | nil
+	// set the timer tid to expire in delay ms (eg. to push back an
+	// idle deadline when some input is received)
+	// return nil if the timer has already expired or been cancelled
+	timerwheel *tw = checktw(L, 1);
+	int ni = tw_lookup(L, tw, 2);
+	lua_Integer delay = luaL_checkinteger(L, 3);
+	if (ni < 0) return 0;
+	tw_unlink(tw, ni);
+	tw->nodes[ni].expire = tw_deadline(tw, delay);
+	tw_link(tw, ni);
+	RET_TRUE;
+}
+
+static int ll_tw_cancel(lua_State *L) {
+	// lua api: tw_cancel(tw, tid) => true | nil
+	// cancel the timer tid.
+	// return nil if the timer has already expired or been cancelled
+	timerwheel *tw = checktw(L, 1);
+	int ni = tw_lookup(L, tw, 2);
+	if (ni < 0) return 0;
+	tw_unlink(tw, ni);
+	tw_release(tw, ni);
+	RET_TRUE;
+}
+
+static int ll_tw_count(lua_State *L) {
+	// lua api: tw_count(tw) => n
+	// return the number of armed timers
+	timerwheel *tw = checktw(L, 1);
+	RET_INT(tw->count);
+}
+
+static int ll_tw_next(lua_State *L) {
+	// lua api: tw_next(tw) => ms
+	// return the number of ms until the next timer expiration, or 
+	// -1 if no timer is armed. It can be passed directly as the 
+	// poll() or epoll_wait() timeout.
+	// (for a timer in a level > 0, this is the time of the start 
+	// of its slot - a lower bound of the expiration time. The next
+	// tw_next() after tw_expire() gives a more precise value)
+	timerwheel *tw = checktw(L, 1);
+	if (tw->count == 0) RET_INT(-1);
+	int64_t next = INT64_MAX, t;
+	for (int lvl = 0; lvl < TW_LEVELS; lvl++) {
+		int shift = TW_BITS * lvl;
+		int64_t base = tw->now >> shift;
+		int cur = base & TW_MASK;
+		// search the slots after the current one, then wrap
+		int idx = tw_nextslot(tw->bm[lvl], cur + 1);
+		if (idx < 0) idx = tw_nextslot(tw->bm[lvl], 0);
+		if (idx < 0) continue;
+		int dist = (idx - cur) & TW_MASK;
+		if (dist == 0) dist = TW_SLOTS;
+		t = (base + dist) << shift;
+		if (t < next) next = t;
+	}
+	t = next - tw_clock();
+	RET_INT(t < 0 ? 0 : t);
+}
+
+static void tw_cascade(timerwheel *tw, int lvl) {
+	// move the timers of the current slot of level lvl to lower levels
+	int idx = (tw->now >> (TW_BITS * lvl)) & TW_MASK;
+	int slot = lvl * TW_SLOTS + idx;
+	int ni = tw->heads[slot];
+	tw->heads[slot] = -1;
+	tw->bm[lvl][idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+	while (ni >= 0) {
+		int next = tw->nodes[ni].next;
+		tw_link(tw, ni);
+		ni = next;
+	}
+}
+
+static int ll_tw_expire(lua_State *L) {
+	// lua api: tw_expire(tw [, now]) => { key, ... }
+	// process the timers expired at time now (in ms, defaults to 
+	// the current CLOCK_MONOTONIC time) and return the list of 
+	// their keys (an empty list if no timer has expired).
+	// the expired timers are released (their tid is no longer valid)
+	timerwheel *tw = checktw(L, 1);
+	int64_t target = luaL_optinteger(L, 2, tw_clock());
+	int n = 0;
+	lua_newtable(L);
+	while (tw->now < target) {
+		if (tw->count == 0) { tw->now = target; break; }
+		int64_t t = tw->now + 1;
+		if (t & TW_MASK) {
+			// skip to the next non-empty level 0 slot or to the 
+			// end of the current level 0 round
+			int idx = tw_nextslot(tw->bm[0], t & TW_MASK);
+			t = (idx >= 0) ? (t & ~(int64_t)TW_MASK) + idx
+				: (t | TW_MASK) + 1;
+			if (t > target) { tw->now = target; break; }
+		}
+		tw->now = t;
+		// cascade the higher levels when the lower index wraps
+		for (int lvl = 1; lvl < TW_LEVELS; lvl++) {
+			if ((t >> (TW_BITS * (lvl - 1))) & TW_MASK) break;
+			tw_cascade(tw, lvl);
+		}
+		// fire the timers in the current level 0 slot
+		int idx = t & TW_MASK;
+		int ni = tw->heads[idx];
+		tw->heads[idx] = -1;
+		tw->bm[0][idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+		while (ni >= 0) {
+			twnode *nd = &tw->nodes[ni];
+			int next = nd->next;
+			lua_pushinteger(L, nd->key);
+			lua_rawseti(L, -2, ++n);
+			nd->slot = -1;
+			tw_release(tw, ni);
+			ni = next;
+		}
+	}
+	return 1;
+}
+
+//----------------------------------------------------------------------
+// worker pool - run blocking filesystem calls in C threads
+//
+// a pool is a full userdata with a set of worker threads. Requests are 
+// queued with wpool_submit() and executed by the workers. Completed 
+// requests are moved to a "done" queue and signalled on an eventfd
+// which can be polled with the other fds of an event loop. Results 
+// are then collected in batches with wpool_collect().
+// Workers never touch the Lua state: request arguments are copied
+// at submit time, and results are converted to Lua values at 
+// collect time.
+
+#define WPOOL_MT "l5_wpool"
+#define WPOOL_MAXTHREADS 64
+
+// whitelisted operations (must match l5/wpool.lua)
+#define WP_OPEN		1	// open(path, flags, mode) => fd
+#define WP_FSYNC	2	// fsync(fd) => 0
+#define WP_FDATASYNC	3	// fdatasync(fd) => 0
+#define WP_STAT		4	// lstat(path) or stat(path) => stat table
+#define WP_UNLINK	5	// unlink(path) => 0
+#define WP_RENAME	6	// rename(oldpath, newpath) => 0
+#define WP_MKDIR	7	// mkdir(path, mode) => 0
+#define WP_READDIR	8	// read all entries => { {name, type}, ...}
+#define WP_READFILE	9	// read whole file => string
+
+struct wp_req {
+	struct wp_req *next;
+	lua_Integer id;
+	int op;
+	int ia, ib;		// integer args (fd, flags, mode, statflag)
+	char *sa, *sb;		// string args (pathnames)
+	int r;			// syscall result
+	int eno;		// errno (0 if no error)
+	char *data;		// result data (readdir, readfile)
+	size_t datalen;
+	struct stat st;		// result of stat
+};
+
+typedef struct wpool {
+	pthread_mutex_t mx;
+	pthread_cond_t cv;
+	struct wp_req *todo, *todotail;	// submitted requests
+	struct wp_req *done, *donetail;	// completed requests
+	int efd;		// eventfd signalled when done is not empty
+	int stop;
+	int nthreads;
+	int pending;		// submitted and not yet collected
+	lua_Integer nextid;
+	pthread_t threads[WPOOL_MAXTHREADS];
+} wpool;
+
+static void wp_freereq(struct wp_req *rq) {
+	free(rq->sa);
+	free(rq->sb);
+	free(rq->data);
+	free(rq);
+}
 
+static void wp_readdir(struct wp_req *rq) {
+	// result data is a sequence of entries "type byte, name, \0"
+	// ("." and ".." are ignored)
+	DIR *dp = opendir(rq->sa);
+	struct dirent *p;
+	size_t len, cap = 4096;
+	char *nd;
+	if (dp == NULL) { rq->r = -1; rq->eno = errno; return; }
+	rq->data = malloc(cap);
+	if (rq->data == NULL) goto nomem;
+	while (1) {
+		errno = 0;
+		p = readdir(dp);
+		if (p == NULL) break;
+		if (strcmp(p->d_name, ".") == 0 
+			|| strcmp(p->d_name, "..") == 0) continue;
+		len = strlen(p->d_name) + 2;
+		if (rq->datalen + len > cap) {
+			cap = cap * 2 + len;
+			nd = realloc(rq->data, cap);
+			if (nd == NULL) goto nomem;
+			rq->data = nd;
+		}
+		rq->data[rq->datalen] = p->d_type;
+		memcpy(rq->data + rq->datalen + 1, p->d_name, len - 1);
+		rq->datalen += len;
+	}
+	rq->eno = errno;
+	rq->r = (errno == 0) ? 0 : -1;
+	closedir(dp);
+	return;
+	nomem:
+	closedir(dp);
+	rq->r = -1;
+	rq->eno = ENOMEM;
+}
 
+static void wp_readfile(struct wp_req *rq) {
+	// read the whole file. the buffer is sized with fstat() and 
+	// grown only for files with no meaningful size (eg. /proc files)
+	struct stat st;
+	size_t cap;
+	ssize_t n;
+	char *nd;
+	int fd = open(rq->sa, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) { rq->r = -1; rq->eno = errno; return; }
+	if (fstat(fd, &st) == -1) goto err;
+	cap = (st.st_size > 0) ? st.st_size + 1 : BUFSIZE;
+	rq->data = malloc(cap);
+	if (rq->data == NULL) { errno = ENOMEM; goto err; }
+	while (1) {
+		if (rq->datalen == cap) {
+			cap = cap * 2;
+			nd = realloc(rq->data, cap);
+			if (nd == NULL) { errno = ENOMEM; goto err; }
+			rq->data = nd;
+		}
+		n = read(fd, rq->data + rq->datalen, cap - rq->datalen);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			goto err;
+		}
+		if (n == 0) break;
+		rq->datalen += n;
+	}
+	close(fd);
+	rq->r = 0;
+	return;
+	err:
+	rq->r = -1;
+	rq->eno = errno;
+	close(fd);
+}
 
+static void wp_run(struct wp_req *rq) {
+	// execute a request (in a worker thread)
+	rq->eno = 0;
+	switch (rq->op) {
+		case WP_OPEN: rq->r = open(rq->sa, rq->ia, rq->ib); break;
+		case WP_FSYNC: rq->r = fsync(rq->ia); break;
+		case WP_FDATASYNC: rq->r = fdatasync(rq->ia); break;
+		case WP_STAT: 
+			if (rq->ia) rq->r = stat(rq->sa, &rq->st);
+			else rq->r = lstat(rq->sa, &rq->st);
+			break;
+		case WP_UNLINK: rq->r = unlink(rq->sa); break;
+		case WP_RENAME: rq->r = rename(rq->sa, rq->sb); break;
+		case WP_MKDIR: rq->r = mkdir(rq->sa, rq->ia); break;
+		case WP_READDIR: wp_readdir(rq); return;
+		case WP_READFILE: wp_readfile(rq); return;
+		default: rq->r = -1; errno = EINVAL;
+	}
+	if (rq->r == -1) rq->eno = errno;
+}
+
+static void *wp_worker(void *arg) {
+	wpool *wp = arg;
+	struct wp_req *rq;
+	uint64_t one = 1;
+	int signal;
+	pthread_mutex_lock(&wp->mx);
+	while (1) {
+		while (wp->todo == NULL && !wp->stop) 
+			pthread_cond_wait(&wp->cv, &wp->mx);
+		if (wp->stop) break;
+		rq = wp->todo;
+		wp->todo = rq->next;
+		if (wp->todo == NULL) wp->todotail = NULL;
+		pthread_mutex_unlock(&wp->mx);
+		wp_run(rq);
+		rq->next = NULL;
+		pthread_mutex_lock(&wp->mx);
+		// signal the eventfd only when the done queue was empty. 
+		// the collector reads the eventfd before taking the queue
+		// so no completion can be missed.
+		signal = (wp->done == NULL);
+		if (wp->donetail) wp->donetail->next = rq;
+		else wp->done = rq;
+		wp->donetail = rq;
+		if (signal) {
+			pthread_mutex_unlock(&wp->mx);
+			write(wp->efd, &one, sizeof(one));
+			pthread_mutex_lock(&wp->mx);
+		}
+	}
+	pthread_mutex_unlock(&wp->mx);
+	return NULL;
+}
+
+static wpool *checkwpool(lua_State *L, int i) {
+	wpool *wp = luaL_checkudata(L, i, WPOOL_MT);
+	if (wp->efd == -1) luaL_error(L, "worker pool is closed");
+	return wp;
+}
+
+static int ll_wpool_new(lua_State *L) {
+	// lua api: wpool_new(nthreads) => pool | nil, errno
+	// nthreads defaults to 4
+	int i, n = luaL_optinteger(L, 1, 4);
+	if (n < 1 || n > WPOOL_MAXTHREADS) LERR("out of range");
+	wpool *wp = lua_newuserdata(L, sizeof(wpool));
+	memset(wp, 0, sizeof(wpool));
+	wp->efd = -1;
+	luaL_getmetatable(L, WPOOL_MT);
+	lua_setmetatable(L, -2);
+	wp->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wp->efd == -1) return nil_errno(L);
+	pthread_mutex_init(&wp->mx, NULL);
+	pthread_cond_init(&wp->cv, NULL);
+	wp->nextid = 1;
+	for (i = 0; i < n; i++) {
+		errno = pthread_create(&wp->threads[i], NULL, wp_worker, wp);
+		if (errno != 0) break;
+		wp->nthreads += 1;
+	}
+	if (wp->nthreads == 0) return nil_errno(L);
+	return 1;
+}
+
+static int ll_wpool_close(lua_State *L) {
+	// lua api: wpool_close(pool) => true
+	// stop the worker threads and discard all requests. Requests 
+	// being executed are completed before the threads exit.
+	// The fds opened by uncollected open requests are closed.
+	// (this is also the pool __gc metamethod)
+	int i;
+	struct wp_req *rq, *nxt;
+	wpool *wp = luaL_checkudata(L, 1, WPOOL_MT);
+	if (wp->efd == -1) RET_TRUE; // already closed
+	pthread_mutex_lock(&wp->mx);
+	wp->stop = 1;
+	pthread_cond_broadcast(&wp->cv);
+	pthread_mutex_unlock(&wp->mx);
+	for (i = 0; i < wp->nthreads; i++) pthread_join(wp->threads[i], NULL);
+	for (rq = wp->todo; rq != NULL; rq = nxt) { 
+		nxt = rq->next; wp_freereq(rq); 
+	}
+	for (rq = wp->done; rq != NULL; rq = nxt) { 
+		nxt = rq->next; 
+		if (rq->op == WP_OPEN && rq->r >= 0) close(rq->r);
+		wp_freereq(rq); 
+	}
+	pthread_mutex_destroy(&wp->mx);
+	pthread_cond_destroy(&wp->cv);
+	close(wp->efd);
+	wp->efd = -1;
+	wp->nthreads = 0;
+	RET_TRUE;
+}
+
+static int ll_wpool_submit(lua_State *L) {
+	// lua api: wpool_submit(pool, op, ...) => request id
+	// op-specific arguments:
+	//	open:	   path, flags, mode
+	//	fsync:	   fd
+	//	fdatasync: fd
+	//	stat:	   path [, statflag]  (statflag=1: stat, default: lstat)
+	//	unlink:	   path
+	//	rename:	   oldpath, newpath
+	//	mkdir:	   path [, mode]
+	//	readdir:   path
+	//	readfile:  path
+	// the request id is a positive integer returned with the
+	// request result by wpool_collect()
+	wpool *wp = checkwpool(L, 1);
+	int op = luaL_checkinteger(L, 2);
+	const char *sa = NULL, *sb = NULL;
+	int ia = 0, ib = 0;
+	// check all the arguments before allocating the request
+	// (a failed check raises an error)
+	switch (op) {
+		case WP_OPEN: 
+			sa = luaL_checkstring(L, 3);
+			ia = luaL_checkinteger(L, 4);
+			ib = luaL_optinteger(L, 5, 0);
+			break;
+		case WP_FSYNC: 
+		case WP_FDATASYNC: 
+			ia = luaL_checkinteger(L, 3);
+			break;
+		case WP_STAT:
+		case WP_MKDIR:
+			sa = luaL_checkstring(L, 3);
+			ia = luaL_optinteger(L, 4, 0);
+			break;
+		case WP_UNLINK:
+		case WP_READDIR:
+		case WP_READFILE:
+			sa = luaL_checkstring(L, 3);
+			break;
+		case WP_RENAME:
+			sa = luaL_checkstring(L, 3);
+			sb = luaL_checkstring(L, 4);
+			break;
+		default:
+			LERR("wpool: unknown operation");
+	}
+	struct wp_req *rq = calloc(1, sizeof(struct wp_req));
+	if (rq == NULL) LERR("out of memory");
+	rq->op = op;
+	rq->ia = ia;
+	rq->ib = ib;
+	if (sa) rq->sa = strdup(sa);
+	if (sb) rq->sb = strdup(sb);
+	if ((sa && rq->sa == NULL) || (sb && rq->sb == NULL)) {
+		free(rq->sa);
+		free(rq->sb);
+		free(rq);
+		LERR("out of memory");
+	}
+	pthread_mutex_lock(&wp->mx);
+	rq->id = wp->nextid++;
+	if (wp->todotail) wp->todotail->next = rq;
+	else wp->todo = rq;
+	wp->todotail = rq;
+	wp->pending += 1;
+	pthread_cond_signal(&wp->cv);
+	pthread_mutex_unlock(&wp->mx);
+	RET_INT(rq->id);
+}
+
+static void wp_pushresult(lua_State *L, struct wp_req *rq) {
+	// push the result value of a successful request
+	size_t i, len;
+	int n;
+	switch (rq->op) {
+		case WP_STAT: // same layout as the table filled by lstat()
+			lua_createtable(L, 13, 0);
+			lua_pushinteger(L, rq->st.st_dev); lua_rawseti(L, -2, 1);
+			lua_pushinteger(L, rq->st.st_ino); lua_rawseti(L, -2, 2);
+			lua_pushinteger(L, rq->st.st_mode); lua_rawseti(L, -2, 3);
+			lua_pushinteger(L, rq->st.st_nlink); lua_rawseti(L, -2, 4);
+			lua_pushinteger(L, rq->st.st_uid); lua_rawseti(L, -2, 5);
+			lua_pushinteger(L, rq->st.st_gid); lua_rawseti(L, -2, 6);
+			lua_pushinteger(L, rq->st.st_rdev); lua_rawseti(L, -2, 7);
+			lua_pushinteger(L, rq->st.st_size); lua_rawseti(L, -2, 8);
+			lua_pushinteger(L, rq->st.st_blksize); lua_rawseti(L, -2, 9);
+			lua_pushinteger(L, rq->st.st_blocks); lua_rawseti(L, -2, 10);
+			lua_pushinteger(L, rq->st.st_atim.tv_sec); lua_rawseti(L, -2, 11);
+			lua_pushinteger(L, rq->st.st_mtim.tv_sec); lua_rawseti(L, -2, 12);
+			lua_pushinteger(L, rq->st.st_ctim.tv_sec); lua_rawseti(L, -2, 13);
+			break;
+		case WP_READDIR: // { {name, type}, ... }
+			lua_newtable(L);
+			for (i = 0, n = 1; i < rq->datalen; i += len + 2, n++) {
+				len = strlen(rq->data + i + 1);
+				lua_createtable(L, 2, 0);
+				lua_pushlstring(L, rq->data + i + 1, len);
+				lua_rawseti(L, -2, 1);
+				lua_pushinteger(L, (unsigned char)rq->data[i]);
+				lua_rawseti(L, -2, 2);
+				lua_rawseti(L, -2, n);
+			}
+			break;
+		case WP_READFILE:
+			lua_pushlstring(L, rq->data, rq->datalen);
+			break;
+		default:
+			lua_pushinteger(L, rq->r);
+	}
+}
+
+static int ll_wpool_collect(lua_State *L) {
+	// lua api: wpool_collect(pool) => { {id, result, eno}, ... }
+	// return the list of all completed requests (may be empty). 
+	// For each request, result is nil if eno is not 0.
+	// (see wpool_submit() for the result of each operation)
+	// the eventfd is reset, so that it can be polled again.
+	wpool *wp = checkwpool(L, 1);
+	struct wp_req *rq, *nxt;
+	uint64_t cnt;
+	int n = 0;
+	// read the eventfd _before_ taking the done queue (see wp_worker)
+	read(wp->efd, &cnt, sizeof(cnt));
+	pthread_mutex_lock(&wp->mx);
+	rq = wp->done;
+	wp->done = wp->donetail = NULL;
+	pthread_mutex_unlock(&wp->mx);
+	lua_newtable(L);
+	for (; rq != NULL; rq = nxt) {
+		nxt = rq->next;
+		lua_createtable(L, 3, 0);
+		lua_pushinteger(L, rq->id); lua_rawseti(L, -2, 1);
+		if (rq->r == -1) lua_pushnil(L); 
+		else wp_pushresult(L, rq);
+		lua_rawseti(L, -2, 2);
+		lua_pushinteger(L, rq->eno); lua_rawseti(L, -2, 3);
+		lua_rawseti(L, -2, ++n);
+		wp_freereq(rq);
+	}
+	pthread_mutex_lock(&wp->mx);
+	wp->pending -= n;
+	pthread_mutex_unlock(&wp->mx);
+	return 1;
+}
+
+static int ll_wpool_fd(lua_State *L) {
+	// lua api: wpool_fd(pool) => eventfd
+	// the fd is readable (POLLIN) when completed requests
+	// are available
+	wpool *wp = checkwpool(L, 1);
+	RET_INT(wp->efd);
+}
+
+static int ll_wpool_pending(lua_State *L) {
+	// lua api: wpool_pending(pool) => n
+	// return the number of submitted requests not yet collected
+	wpool *wp = checkwpool(L, 1);
+	int n;
+	pthread_mutex_lock(&wp->mx);
+	n = wp->pending;
+	pthread_mutex_unlock(&wp->mx);
+	RET_INT(n);
+}
 
 
 //----------------------------------------------------------------------
@@ -884,11 +3481,23 @@ static const struct luaL_Reg l5lib[] = {
 	{"environ", ll_environ},
 	//
 	{"msleep", ll_msleep},
+	{"clock_gettime", ll_clock_gettime},
 	{"fork", ll_fork},
 	{"waitpid", ll_waitpid},
 	{"kill", ll_kill},
 	{"execve", ll_execve},
 	//
+	{"sched_setaffinity", ll_sched_setaffinity},
+	{"sched_getaffinity", ll_sched_getaffinity},
+	{"sched_setscheduler", ll_sched_setscheduler},
+	{"sched_getscheduler", ll_sched_getscheduler},
+	{"setpriority", ll_setpriority},
+	{"getpriority", ll_getpriority},
+	{"ioprio_set", ll_ioprio_set},
+	{"ioprio_get", ll_ioprio_get},
+	{"prlimit", ll_prlimit},
+	{"nprocs", ll_nprocs},
+	//
 	{"open", ll_open},
 	{"close", ll_close},
 	{"fcntl", ll_fcntl},
@@ -900,6 +3509,21 @@ static const struct luaL_Reg l5lib[] = {
 	{"fileno", ll_fileno},
 	{"fdopen", ll_fdopen},
 	{"ftruncate", ll_ftruncate},
+	{"readfile", ll_readfile},
+	{"writefile", ll_writefile},
+	{"alog_open", ll_alog_open},
+	{"alog_close", ll_alog_close},
+	{"alog_append", ll_alog_append},
+	{"alog_commit", ll_alog_commit},
+	{"alog_seq", ll_alog_seq},
+	{"alog_readseg", ll_alog_readseg},
+	//
+	{"buf_new", ll_buf_new},
+	{"buf_free", ll_buf_free},
+	{"buf_size", ll_buf_size},
+	{"buf_resize", ll_buf_resize},
+	{"buf_get", ll_buf_get},
+	{"buf_set", ll_buf_set},
 	//
 	{"opendir", ll_opendir},
 	{"readdir", ll_readdir},
@@ -918,30 +3542,105 @@ static const struct luaL_Reg l5lib[] = {
 	//
 	{"ioctl", ll_ioctl},
 	{"ioctl_int", ll_ioctl_int},
+	{"ioctl_buf", ll_ioctl_buf},
 	{"poll", ll_poll},
 	{"pollin", ll_pollin},
 	//
+	{"inotify_init", ll_inotify_init},
+	{"inotify_add_watch", ll_inotify_add_watch},
+	{"inotify_rm_watch", ll_inotify_rm_watch},
+	{"inotify_read", ll_inotify_read},
+	//
+	{"term_new", ll_term_new},
+	{"term_free", ll_term_free},
+	{"term_resize", ll_term_resize},
+	{"term_invalidate", ll_term_invalidate},
+	{"term_clear", ll_term_clear},
+	{"term_put", ll_term_put},
+	{"term_cursor", ll_term_cursor},
+	{"term_flush", ll_term_flush},
+	{"term_readkeys", ll_term_readkeys},
+	{"term_winchfd", ll_term_winchfd},
+	{"term_getsize", ll_term_getsize},
+	//
+	{"rdr_new", ll_rdr_new},
+	{"rdr_free", ll_rdr_free},
+	{"rdr_buffered", ll_rdr_buffered},
+	{"rdr_read", ll_rdr_read},
+	{"rdr_readline", ll_rdr_readline},
+	{"rdr_readuntil", ll_rdr_readuntil},
+	{"rdr_readbytes", ll_rdr_readbytes},
+	{"rdr_readframe", ll_rdr_readframe},
+	//
 	{"socket", ll_socket},
 	{"setsockopt", ll_setsockopt},
+	{"getsockopt", ll_getsockopt},
 	{"setsocktimeout", ll_setsocktimeout},
 	{"bind", ll_bind},
 	{"listen", ll_listen},
 	{"accept", ll_accept},
 	{"connect", ll_connect},
+	{"shutdown", ll_shutdown},
 	{"recvfrom", ll_recvfrom},
 	{"recv", ll_recv},
 	{"sendto", ll_sendto},
 	{"send", ll_send},
+	{"socketpair", ll_socketpair},
+	{"sendmsg", ll_sendmsg},
+	{"recvmsg", ll_recvmsg},
+	{"zc_reap", ll_zc_reap},
 	{"getsockname", ll_getsockname},
 	{"getpeername", ll_getpeername},
 	{"getaddrinfo", ll_getaddrinfo},
 	{"getnameinfo", ll_getnameinfo},
 	//
+	{"wpool_new", ll_wpool_new},
+	{"wpool_close", ll_wpool_close},
+	{"wpool_submit", ll_wpool_submit},
+	{"wpool_collect", ll_wpool_collect},
+	{"wpool_fd", ll_wpool_fd},
+	{"wpool_pending", ll_wpool_pending},
+	//
+	{"tw_new", ll_tw_new},
+	{"tw_free", ll_tw_free},
+	{"tw_arm", ll_tw_arm},
+	{"tw_rearm", ll_tw_rearm},
+	{"tw_cancel", ll_tw_cancel},
+	{"tw_count", ll_tw_count},
+	{"tw_next", ll_tw_next},
+	{"tw_expire", ll_tw_expire},
+	//
 	{NULL, NULL},
 };
 
 int luaopen_l5 (lua_State *L) {
 	
+	// metatables for full userdata objects
+	luaL_newmetatable(L, WPOOL_MT);
+	lua_pushcfunction(L, ll_wpool_close);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, BUFFER_MT);
+	lua_pushcfunction(L, ll_buf_free);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, READER_MT);
+	lua_pushcfunction(L, ll_rdr_free);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, TERM_MT);
+	lua_pushcfunction(L, ll_term_free);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, ALOG_MT);
+	lua_pushcfunction(L, ll_alog_close);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, TW_MT);
+	lua_pushcfunction(L, ll_tw_free);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+
 	// register main library functions
 	luaL_newlib (L, l5lib);
 	lua_pushliteral (L, "VERSION");
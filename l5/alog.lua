@@ -0,0 +1,155 @@
+-- Copyright (c) 2021  Phil Leblanc  -- see LICENSE file
+------------------------------------------------------------------------
+--[[		L5 append-only log with group commit
+
+Records appended within a commit window are written and synced
+together, with one write and one fdatasync() (see l5.alog_* functions
+in l5.c for the file format and the recovery on open).
+
+	lg, lastseq = alog.open(dirpath, opt)
+	seq = alog.append(lg, str, waiter)
+	...
+	-- in the event loop: use alog.timeout(lg) to bound the poll
+	-- timeout, and call alog.tick(lg) after each poll.
+	...
+	alog.close(lg)
+
+opt (all optional):
+	segsize		segment size in bytes (default 64 MB)
+	window		commit window in ms (default 2)
+	maxbytes	commit as soon as the pending records reach
+			maxbytes bytes (default 1 MB)
+	syncrange	use sync_file_range() instead of fdatasync()
+			(faster, but not safe against a power loss)
+
+waiter is an optional function. It is called as waiter(seq) when
+record seq is durable.
+
+alog.replay(dirpath, func) calls func(seq, str) for each record in
+the log, in order.
+
+]]
+
+local l5 = require "l5"
+local fs = require "l5.fs"
+local util = require "l5.util"
+
+local insert, sort = table.insert, table.sort
+local msnow = util.msnow
+
+------------------------------------------------------------------------
+
+alog = {}
+
+local ALOG_SYNCRANGE = 1
+
+function alog.open(dirpath, opt)
+	-- open or create the log in directory dirpath
+	-- return the log object and the sequence number of the last
+	-- record (0 for an empty log), or nil, errno
+	opt = opt or {}
+	local flags = opt.syncrange and ALOG_SYNCRANGE or 0
+	local h, lastseq = l5.alog_open(dirpath, opt.segsize, flags)
+	if not h then return nil, lastseq end
+	local lg = {
+		h = h,
+		window = opt.window or 2,
+		maxbytes = opt.maxbytes or 1024 * 1024,
+		t0 = nil,	-- time of the first pending append
+		waiters = {},	-- list of seq, func (sorted by seq)
+	}
+	return lg, lastseq
+end
+
+function alog.commit(lg)
+	-- commit the pending records now, and call the waiters
+	-- return the sequence number of the last durable record
+	-- or nil, errno (the commit is retried at the next tick)
+	local seq, eno = l5.alog_commit(lg.h)
+	if not seq then return nil, eno end
+	lg.t0 = nil
+	local wl = lg.waiters
+	if #wl > 0 then
+		lg.waiters = {}
+		for i = 1, #wl, 2 do wl[i+1](wl[i]) end
+	end
+	return seq
+end
+
+function alog.append(lg, str, waiter)
+	-- append a record. return its sequence number.
+	-- if the pending records reach maxbytes, they are committed. If
+	-- this commit fails, return seq, errno: the record is appended
+	-- anyway (it must not be appended again), and the commit is
+	-- retried at the next tick.
+	local seq = l5.alog_append(lg.h, str)
+	if waiter then
+		insert(lg.waiters, seq)
+		insert(lg.waiters, waiter)
+	end
+	lg.t0 = lg.t0 or msnow()
+	local _, _, pending = l5.alog_seq(lg.h)
+	if pending >= lg.maxbytes then
+		local r, eno = alog.commit(lg)
+		if not r then return seq, eno end
+	end
+	return seq
+end
+
+function alog.timeout(lg)
+	-- return the number of ms until the end of the commit window,
+	-- or -1 if there is no pending record (to be used as a poll
+	-- timeout)
+	if not lg.t0 then return -1 end
+	local t = lg.t0 + lg.window - msnow()
+	return t > 0 and t or 0
+end
+
+function alog.tick(lg)
+	-- commit the pending records if the commit window has ended
+	-- return the sequence number of the last durable record
+	-- or nil, errno
+	if lg.t0 and msnow() - lg.t0 >= lg.window then
+		return alog.commit(lg)
+	end
+	local _, commitseq = l5.alog_seq(lg.h)
+	return commitseq
+end
+
+function alog.seq(lg)
+	-- return the sequence numbers of the last appended record and
+	-- of the last durable record
+	local lastseq, commitseq = l5.alog_seq(lg.h)
+	return lastseq, commitseq
+end
+
+function alog.close(lg)
+	-- commit the pending records and close the log
+	local r, eno = alog.commit(lg)
+	l5.alog_close(lg.h)
+	if not r then return nil, eno end
+	return true
+end
+
+function alog.replay(dirpath, func)
+	-- call func(seq, str) for each record in the log
+	-- return true or nil, errno
+	local sl, eno = fs.dirmap(dirpath, function(fname, ftype, t)
+		if fname:match("^%x+%.log$") and #fname == 20 then
+			insert(t, fname)
+		end
+		return true
+	end)
+	if not sl then return nil, eno end
+	sort(sl) -- (fixed-width hex names sort as seq numbers)
+	for _, fname in ipairs(sl) do
+		local rl
+		rl, eno = l5.alog_readseg(dirpath .. "/" .. fname)
+		if not rl then return nil, eno end
+		for _, r in ipairs(rl) do func(r[1], r[2]) end
+	end
+	return true
+end
+
+------------------------------------------------------------------------
+return alog
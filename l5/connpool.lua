@@ -0,0 +1,215 @@
+-- Copyright (c) 2021  Phil Leblanc  -- see LICENSE file
+------------------------------------------------------------------------
+--[[		L5 outbound connection pool
+
+Keep the connections to upstream servers open after use, so that the
+next requests reuse a warm connection instead of paying a new TCP
+handshake each time. Connections are keyed by server sockaddr.
+
+	cp = connpool.new{maxperhost=8, maxtotal=64, idle=30000}
+	so, eno = connpool.get(cp, sa)  -- sa is a sockaddr string
+	... use socket object so (see l5/sock.lua) ...
+	connpool.put(cp, so)	-- the connection can be reused
+	-- or connpool.discard(cp, so) if the connection is not reusable
+	-- (i/o error, response not fully read, ...)
+	connpool.expire(cp)	-- close idle connections (call it
+				-- periodically, eg. from the event loop)
+	connpool.close(cp)	-- close all idle connections
+
+options (all optional):
+	maxperhost	max number of connections per sockaddr (default 8)
+	maxtotal	max number of connections (default 64)
+	idle		idle timeout in ms (default 30000)
+	nonblocking	create non-blocking sockets (default false)
+	timeout		for a blocking pool, max time in ms to wait
+			for a new connection (default 5000)
+	fastopen	use TCP fast open (default false)
+
+A connection is counted in the limits from get() until discard(), or
+until it is closed while idle. When a limit is reached, get() returns
+nil, connpool.LIMIT.
+
+On checkout, an idle connection is checked with a zero-timeout poll()
+for POLLIN|POLLRDHUP: a connection closed by the server, reset or
+with unexpected pending input is closed, and the next one is tried.
+
+With a non-blocking pool, get() can return a socket still connecting
+(so.connecting is true). Wait for it to be writable in the event loop,
+then call sock.connected(so) to get the result of the connect.
+
+]]
+
+local l5 = require "l5"
+local sock = require "l5.sock"
+local util = require "l5.util"
+
+local insert, remove = table.insert, table.remove
+local msnow = util.msnow
+
+------------------------------------------------------------------------
+
+connpool = {}
+
+connpool.LIMIT = "connection limit reached"
+
+local POLLIN, POLLRDHUP = 0x01, 0x2000
+local F_GETFL, F_SETFL = 3, 4
+local O_NONBLOCK = 0x800
+
+function connpool.new(opt)
+	-- create a connection pool (see options above)
+	opt = opt or {}
+	local cp = {
+		maxperhost = opt.maxperhost or 8,
+		maxtotal = opt.maxtotal or 64,
+		idle = opt.idle or 30000,
+		nonblocking = opt.nonblocking,
+		timeout = opt.timeout or 5000,
+		fastopen = opt.fastopen,
+		total = 0,	-- number of connections
+		nhost = {},	-- sa => number of connections
+		idlel = {},	-- sa => list of idle connections
+			-- (most recently used at the end)
+	}
+	return cp
+end
+
+local function alive(so)
+	-- return true if an idle connection can be reused
+	if sock.buffered(so) > 0 then return false end
+	local pfd = {(so.fd << 32) | ((POLLIN | POLLRDHUP) << 16)}
+	local n = l5.poll(pfd, 0)
+	-- n == 0: no input, no hangup, no error
+	return n == 0
+end
+
+local function connect(cp, sa)
+	-- open a new connection to sa
+	-- return the socket object or nil, eno
+	local so, eno = sock.sconnect(sa, true, cp.fastopen)
+	if not so or cp.nonblocking then return so, eno end
+	-- blocking pool: the connect is done in non-blocking mode to 
+	-- enforce the timeout, then the socket is set to blocking mode
+	local r
+	r, eno = sock.connected(so, cp.timeout)
+	if r then
+		r, eno = l5.fcntl(so.fd, F_GETFL)
+		if r then
+			r, eno = l5.fcntl(so.fd, F_SETFL, r & ~O_NONBLOCK)
+		end
+	elseif eno == sock.EINPROGRESS then
+		eno = sock.TIMEOUT
+	end
+	if not r then
+		sock.close(so)
+		return nil, eno
+	end
+	so.nonblocking = nil
+	return so
+end
+
+local function evict(cp)
+	-- close the least recently used idle connection
+	-- return true, or nil if there is no idle connection
+	local oldest, osa
+	for sa, il in pairs(cp.idlel) do
+		local so = il[1]
+		if so and (not oldest or so.idle_since < oldest.idle_since) then
+			oldest, osa = so, sa
+		end
+	end
+	if not oldest then return nil end
+	remove(cp.idlel[osa], 1)
+	connpool.discard(cp, oldest)
+	return true
+end
+
+function connpool.get(cp, sa)
+	-- return a connection to sa (a sockaddr string): a live idle
+	-- connection if any, else a new connection.
+	-- return the socket object or nil, eno | connpool.LIMIT
+	local il = cp.idlel[sa]
+	while il and #il > 0 do
+		local so = remove(il)
+		so.idle_since = nil
+		if alive(so) then return so end
+		connpool.discard(cp, so)
+	end
+	local n = cp.nhost[sa] or 0
+	if n >= cp.maxperhost then return nil, connpool.LIMIT end
+	if cp.total >= cp.maxtotal and not evict(cp) then
+		return nil, connpool.LIMIT
+	end
+	local so, eno = connect(cp, sa)
+	if not so then return nil, eno end
+	cp.nhost[sa] = n + 1
+	cp.total = cp.total + 1
+	return so
+end
+
+function connpool.put(cp, so)
+	-- return a connection to the pool after use. The connection must
+	-- be in a clean state (response fully read)
+	local sa = so.ssa
+	local il = cp.idlel[sa]
+	if not il then
+		il = {}
+		cp.idlel[sa] = il
+	end
+	so.idle_since = msnow()
+	insert(il, so)
+end
+
+function connpool.discard(cp, so)
+	-- close a connection obtained with get() and release its slot
+	-- in the pool limits.
+	local sa = so.ssa
+	sock.close(so)
+	cp.nhost[sa] = cp.nhost[sa] - 1
+	if cp.nhost[sa] == 0 then cp.nhost[sa] = nil end
+	cp.total = cp.total - 1
+end
+
+function connpool.expire(cp, t)
+	-- close the connections idle for more than the idle timeout
+	-- t is the current CLOCK_MONOTONIC time in ms (defaults to now)
+	-- return the number of closed connections
+	t = t or msnow()
+	local cnt = 0
+	for sa, il in pairs(cp.idlel) do
+		-- il is sorted by idle_since
+		local i = 1
+		while il[i] and t - il[i].idle_since > cp.idle do i = i + 1 end
+		for j = 1, i - 1 do
+			connpool.discard(cp, remove(il, 1))
+			cnt = cnt + 1
+		end
+		if #il == 0 then cp.idlel[sa] = nil end
+	end
+	return cnt
+end
+
+function connpool.close(cp)
+	-- close all idle connections
+	-- (connections in use must still be returned with put() or
+	-- discard())
+	for sa, il in pairs(cp.idlel) do
+		for _, so in ipairs(il) do connpool.discard(cp, so) end
+		cp.idlel[sa] = nil
+	end
+end
+
+function connpool.count(cp, sa)
+	-- return the number of connections (to sa if provided, else
+	-- the total number of connections), and the number of idle
+	-- connections among them
+	local n, ni = cp.total, 0
+	for isa, il in pairs(cp.idlel) do
+		if not sa or isa == sa then ni = ni + #il end
+	end
+	if sa then n = cp.nhost[sa] or 0 end
+	return n, ni
+end
+
+------------------------------------------------------------------------
+return connpool
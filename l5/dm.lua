@@ -25,23 +25,27 @@ local errm, rpad, pf = util.errm, util.rpad, util.pf
 
 -- see linux/dm-ioctl.h
 
-local argsize = 512  	-- buffer size for ioctl() 
-			-- should be enough for dmcrypt
+local argsize = 16384  	-- initial buffer size for ioctl() 
+			-- it is grown (and remembered for the next 
+			-- ioctls) when the kernel reports that the 
+			-- result does not fit
 
 local DMISIZE = 312  	-- sizeof(struct dm_ioctl)
 
+local DM_BUFFER_FULL_FLAG = (1<<8)
+local DM_STATUS_TABLE_FLAG = (1<<4)
 
 
-
-local function fill_dmioctl(dname)
-	local tot
-	local flags = (1<<4)
+local function fill_dmioctl(dname, datasize, tcount)
+	-- datasize is the total arg size, tcount the number of targets
+	-- (both are optional)
+	local flags = DM_STATUS_TABLE_FLAG
 	local dev = 0
 	local s = spack("I4I4I4I4I4I4I4I4I4I4I8z",
 		4, 0, 0,	-- version (must pass it, or ioctl fails)
-		argsize,	-- data_size (total arg size)
+		datasize or argsize,	-- data_size (total arg size)
 		DMISIZE,	-- data_start
-		1, 0,		-- target_count, open_count
+		tcount or 1, 0,	-- target_count, open_count
 		flags, 		-- flags (1<<4 for dm_table_status)
 		0, 0,		-- event_nr, padding
 		dev,		-- dev(u64)
@@ -66,6 +70,41 @@ local function fill_dmtarget(secstart, secnb, targettype, options)
 	return s
 end
 
+local function dm_ioctl(cfd, cmd, dname, data, tcount)
+	-- run a dm ioctl in place on a buffer. data is the optional
+	-- payload following the dm_ioctl struct (eg. target specs), 
+	-- tcount the number of targets in data (defaults to 1).
+	-- if the kernel sets DM_BUFFER_FULL_FLAG, the buffer is grown 
+	-- and the ioctl is re-issued.
+	-- return the result (dm_ioctl struct and data) as a string
+	-- or nil, errno
+	data = data or ""
+	local size = argsize
+	while size < DMISIZE + #data do size = size * 2 end
+	local b = l5.buf_new(size)
+	local r, eno, flags, dsize
+	while true do
+		l5.buf_set(b, 1, fill_dmioctl(dname, size, tcount) .. data)
+		r, eno = l5.ioctl_buf(cfd, cmd, b)
+		if not r then 
+			l5.buf_free(b)
+			return nil, eno 
+		end
+		flags = sunpack("I4", l5.buf_get(b, 29, 4))
+		if flags & DM_BUFFER_FULL_FLAG == 0 then break end
+		size = size * 2
+		argsize = size
+		l5.buf_resize(b, size)
+		l5.buf_set(b, 1, ('\0'):rep(size))
+	end
+	-- data_size is set by the kernel to the size actually used
+	dsize = sunpack("I4", l5.buf_get(b, 13, 4))
+	if dsize > size then dsize = size end
+	local s = l5.buf_get(b, 1, dsize)
+	l5.buf_free(b)
+	return s
+end
+
 local function dm_opencontrol()
 	local fd, eno = l5.open("/dev/mapper/control", 0, 0) 
 		--O_RDONLY, mode=0
@@ -74,8 +113,7 @@ end
 
 local function dm_getversion(cfd)
 	local DM_VERSION= 0xc138fd00
-	local arg = fill_dmioctl("")
-	local s, eno = l5.ioctl(cfd, DM_VERSION, arg, argsize)
+	local s, eno = dm_ioctl(cfd, DM_VERSION, "")
 	assert(s, errm(eno, "dm_version ioctl"))
 --~ 	px(s)
 	local major, minor, patch = ("I4I4I4"):unpack(s)
@@ -84,15 +122,17 @@ end
 
 local function dm_getdevlist(cfd)
 	local DM_LIST_DEVICES= 0xc138fd02
-	local arg = fill_dmioctl("")
-	local s, eno = l5.ioctl(cfd, DM_LIST_DEVICES, arg, argsize)
+	local s, eno = dm_ioctl(cfd, DM_LIST_DEVICES, "")
 	if not s then return nil, errm(eno, "ioctl")  end
 	-- devlist is after the dm_ioctl struct
-	local data = s:sub(DMISIZE + 1)
+	local dstart = sunpack("I4", s, 17)
+	local data = s:sub(dstart + 1)
 	local i, devlist = 1, {}
 	local dev, nxt, name
-	while true do
+	while i + 12 <= #data do
 		dev, nxt, name = sunpack("I8I4z", data, i)
+		-- an empty list is returned as one entry with dev=0
+		if dev == 0 and nxt == 0 and #devlist == 0 then break end
 		table.insert(devlist, {dev=dev, name=name})
 		if nxt == 0 then break end
 		i = i + nxt
@@ -102,26 +142,28 @@ end
 
 local function dm_create(cfd, name)
 	local DM_DEV_CREATE = 0xc138fd03
-	local arg = fill_dmioctl(name)
-	local s, eno = l5.ioctl(cfd, DM_DEV_CREATE, arg, argsize)
+	local s, eno = dm_ioctl(cfd, DM_DEV_CREATE, name)
 	if not s then return nil, errm(eno, "ioctl dm_dev_create") end
 	local dev = sunpack("I8", s, 41)
 	return dev
 end
 
-local function dm_tableload(cfd, name, secstart, secsize, ttype, options)
+local function dm_tableload(cfd, name, targets)
+	-- targets is a list of {secstart, secnb, ttype, options}
 	local DM_TABLE_LOAD = 0xc138fd09
-	local arg = fill_dmioctl(name)
-	arg = arg .. fill_dmtarget(secstart, secsize, ttype, options)
-	local s, eno = l5.ioctl(cfd, DM_TABLE_LOAD, arg, argsize)
+	local tl = {}
+	for i, t in ipairs(targets) do
+		tl[i] = fill_dmtarget(t[1], t[2], t[3], t[4])
+	end
+	local s, eno = dm_ioctl(cfd, DM_TABLE_LOAD, name, 
+		table.concat(tl), #targets)
 	if not s then return nil, errm(eno, "ioctl dm_table_load") end
 	return true
 end	
 
 local function dm_suspend(cfd, name)
 	DM_DEV_SUSPEND = 0xc138fd06
-	local arg = fill_dmioctl(name)
-	local s, eno = l5.ioctl(cfd, DM_DEV_SUSPEND, arg, argsize)
+	local s, eno = dm_ioctl(cfd, DM_DEV_SUSPEND, name)
 	if not s then return nil, errm(eno, "ioctl dm_dev_suspend") end
 	local flags = sunpack("I4", s, 29)
 	return flags
@@ -129,39 +171,49 @@ end
 
 local function dm_remove(cfd, name)
 	DM_DEV_REMOVE = 0xc138fd04
-	local arg = fill_dmioctl(name)
-	local s, eno = l5.ioctl(cfd, DM_DEV_REMOVE, arg, argsize)
+	local s, eno = dm_ioctl(cfd, DM_DEV_REMOVE, name)
 	if not s then return nil, errm(eno, "ioctl dm_dev_remove") end
 	local flags = sunpack("I4", s, 29)
 	return flags
 end
 
 local function dm_gettable(cfd, name)
-	-- get _one_ table. (ok for basic dmcrypt)
+	-- get the list of targets of a device
+	-- return a list of tables {secstart=, secnb=, ttype=, options=}
 	local DM_TABLE_STATUS = 0xc138fd0c
-	local arg = fill_dmioctl(name)
-	local s, eno = l5.ioctl(cfd, DM_TABLE_STATUS, arg, argsize)
+	local s, eno = dm_ioctl(cfd, DM_TABLE_STATUS, name)
 	if not s then return nil, errm(eno, "ioctl dm_table_status") end
-	-- for a single target,
-	-- s :: struct dm_ioctl .. struct dm_target_spec .. options
-	-- (tbl is here because flags was 1<<4)
+	-- s :: struct dm_ioctl .. (struct dm_target_spec .. options)*
+	-- (tables are here because flags was 1<<4)
+	-- spec.next is the offset of the next spec from data_start
 	local totsiz, dstart, tcnt, ocnt, flags = sunpack("I4I4I4I4I4", s, 13)
 --~ 	print("totsiz, dstart, tcnt, ocnt, flags")
 --~ 	print(totsiz, dstart, tcnt, ocnt, flags)
-	local data = s:sub(dstart+1, totsiz) -- struct dm_target_spec
-	local tbl = {}
-	local tnext, ttype
-	tbl.secstart, tbl.secnb, tnext, ttype, tbl.options = 
-		sunpack("I8I8xxxxI4c16z", data)
-	tbl.ttype = sunpack("z", ttype)
-	return tbl
+	local tl = {}
+	local i = dstart + 1 -- index of the first struct dm_target_spec
+	for n = 1, tcnt do
+		local tbl = {}
+		local tnext, ttype
+		tbl.secstart, tbl.secnb, tnext, ttype, tbl.options = 
+			sunpack("I8I8xxxxI4c16z", s, i)
+		tbl.ttype = sunpack("z", ttype)
+		tl[n] = tbl
+		i = dstart + tnext + 1
+	end
+	return tl
 end
 
 local function dm_gettable_str(cfd, name)
-	local tbl, em = dm_gettable(cfd, name)
-	if not tbl then return nil, em end
-	return strf("%d %d %s %s", 
-		tbl.secstart, tbl.secnb, tbl.ttype, tbl.options)
+	-- return the table as a string, one line per target
+	-- (same format as 'dmsetup table')
+	local tl, em = dm_gettable(cfd, name)
+	if not tl then return nil, em end
+	local lines = {}
+	for i, tbl in ipairs(tl) do
+		lines[i] = strf("%d %d %s %s", 
+			tbl.secstart, tbl.secnb, tbl.ttype, tbl.options)
+	end
+	return table.concat(lines, "\n")
 end
 
 ------------------------------------------------------------------------
@@ -183,13 +235,25 @@ end
 
 
 function dm.setup(dname, tblstr)
-	local pat = "^(%d+) (%d+) (%S+) (.+)$"
-	local start, siz, typ, opt = tblstr:match(pat)
+	-- tblstr is a table string with one line per target
+	-- (same format as 'dmsetup table'). Blank lines are ignored.
+	local pat = "^%s*(%d+) (%d+) (%S+) (.+)$"
+	local targets = {}
+	for line in tblstr:gmatch("[^\n]+") do
+		local start, siz, typ, opt = line:match(pat)
+		if start then
+			table.insert(targets, 
+				{tonumber(start), tonumber(siz), typ, opt})
+		elseif line:match("%S") then
+			return nil, "invalid table"
+		end
+	end
+	if #targets == 0 then return nil, "invalid table" end
 	local cfd = dm_opencontrol()
 	local r, em = dm_create(cfd, dname)
 	local dmdev = r  -- the dm device (eg. 0xfb01 for /dev/dm-1)
 	if not r then goto close end
-	r, em = dm_tableload(cfd, dname, start, siz, typ, opt)
+	r, em = dm_tableload(cfd, dname, targets)
 	if not r then goto close end
 	r, em = dm_suspend(cfd, dname)
 	::close::
@@ -211,6 +275,15 @@ function dm.gettable(dname)
 	return r, em
 end
 
+function dm.targets(dname)
+	-- return the list of targets of a device. each target is
+	-- a table {secstart=, secnb=, ttype=, options=}
+	local cfd = dm_opencontrol()
+	local r, em = dm_gettable(cfd, dname)
+	l5.close(cfd)
+	return r, em
+end
+
 function dm.devlist()
 	local cfd = dm_opencontrol()
 	local dl, em = dm_getdevlist(cfd)
@@ -138,6 +138,41 @@ function fs.touch(fpath, time)
 end
 
 
+------------------------------------------------------------------------
+-- whole-file read and write
+
+function fs.readfile(fpath)
+	-- return the content of file fpath as a string, or nil, errmsg
+	-- (the file size is obtained with fstat, and the file is read
+	-- with read() into one right-sized string)
+	local s, eno = l5.readfile(fpath)
+	if not s then return nil, errm(eno, "readfile") end
+	return s
+end
+
+function fs.writefile(fpath, str, opt)
+	-- write string str to file fpath. 
+	-- opt is an optional table:
+	--   opt.atomic: write a temp file in the same directory, 
+	--	fdatasync it and rename it to fpath (readers see 
+	--	either the old or the new content)
+	--   opt.sync: fdatasync the file before closing it
+	--	(always done if atomic)
+	--   opt.syncdir: fsync the directory after rename, so that 
+	--	the rename is durable (only with atomic)
+	--   opt.mode: the file mode (defaults to 0666 - modified 
+	--	by umask)
+	--   opt.size: preallocate disk space up to size bytes 
+	--	(with fallocate)
+	-- return true or nil, errmsg
+	opt = opt or {}
+	local flags = (opt.atomic and 1 or 0) | (opt.sync and 2 or 0)
+		| (opt.syncdir and 4 or 0)
+	local r, eno = l5.writefile(fpath, str, flags, opt.mode, opt.size)
+	if not r then return nil, errm(eno, "writefile") end
+	return true
+end
+
 ------------------------------------------------------------------------
 -- directories
 
@@ -0,0 +1,309 @@
+-- Copyright (c) 2021  Phil Leblanc  -- see LICENSE file
+------------------------------------------------------------------------
+--[[		L5 inotify file watcher
+
+w = inotify.new(opt) => watcher | nil, errmsg
+	opt is an optional table:
+	opt.recursive: also watch subdirectories, including the 
+		directories created or moved in the tree later
+	opt.mask: the inotify mask (defaults to inotify.DEFAULT_MASK)
+	opt.window: coalescing window in ms (defaults to 0 - no 
+		coalescing). Events matching opt.coalesce for the same 
+		path are merged into one event, returned window ms after
+		the first one.
+	opt.coalesce: mask of the events which can be coalesced
+		(defaults to IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE)
+		
+inotify.add(w, path) => true | nil, errmsg
+inotify.remove(w, path)
+inotify.read(w) => evlist | nil, errmsg
+	read all the pending events (in one read) and return the list
+	of ready events (possibly empty). Each event is a table
+	{ path=, mask=, count= } where mask is the OR of the inotify
+	masks of the merged events and count the number of merged 
+	events. If the kernel queue has overflowed, an event with
+	mask IN_Q_OVERFLOW and no path is returned (the watched trees 
+	should be rescanned)
+inotify.timeout(w) => ms
+	return the time before the next coalesced event is ready, or -1.
+	to be used as a poll timeout.
+inotify.flush(w) => evlist
+	return all the pending coalesced events
+inotify.close(w)
+
+w.fd is the inotify fd (non-blocking). It can be polled along with 
+sockets. When it is readable or when the poll timeout given by 
+inotify.timeout() has elapsed, call inotify.read()
+
+Note: fanotify is not supported.
+
+]]
+
+local l5 = require "l5"
+local util = require "l5.util"
+local fs = require "l5.fs"
+
+local insert = table.insert
+local errm, msnow = util.errm, util.msnow
+
+------------------------------------------------------------------------
+
+inotify = {}
+
+-- inotify masks (see sys/inotify.h)
+inotify.IN_ACCESS = 0x00000001
+inotify.IN_MODIFY = 0x00000002
+inotify.IN_ATTRIB = 0x00000004
+inotify.IN_CLOSE_WRITE = 0x00000008
+inotify.IN_CLOSE_NOWRITE = 0x00000010
+inotify.IN_OPEN = 0x00000020
+inotify.IN_MOVED_FROM = 0x00000040
+inotify.IN_MOVED_TO = 0x00000080
+inotify.IN_CREATE = 0x00000100
+inotify.IN_DELETE = 0x00000200
+inotify.IN_DELETE_SELF = 0x00000400
+inotify.IN_MOVE_SELF = 0x00000800
+inotify.IN_UNMOUNT = 0x00002000
+inotify.IN_Q_OVERFLOW = 0x00004000
+inotify.IN_IGNORED = 0x00008000
+inotify.IN_ONLYDIR = 0x01000000
+inotify.IN_DONT_FOLLOW = 0x02000000
+inotify.IN_EXCL_UNLINK = 0x04000000
+inotify.IN_ISDIR = 0x40000000
+
+local IN = inotify
+
+inotify.DEFAULT_MASK = IN.IN_MODIFY | IN.IN_ATTRIB | IN.IN_CLOSE_WRITE 
+	| IN.IN_MOVED_FROM | IN.IN_MOVED_TO | IN.IN_CREATE | IN.IN_DELETE
+	| IN.IN_DELETE_SELF | IN.IN_MOVE_SELF
+
+-- events always watched in recursive mode, to follow the tree
+local TREEMASK = IN.IN_CREATE | IN.IN_MOVED_FROM | IN.IN_MOVED_TO
+
+local IN_NONBLOCK, IN_CLOEXEC = 0x800, 0x80000
+local EAGAIN = 11
+
+local function isdir(path, ftype)
+	-- ftype is a readdir() file type. Some filesystems return 
+	-- DT_UNKNOWN (0). then use lstat
+	if ftype == 4 then return true end
+	if ftype ~= 0 then return false end
+	return fs.lstat3(path) == 4
+end
+
+local function addwatch(w, path)
+	local mask = w.mask
+	if w.recursive then mask = mask | TREEMASK end
+	local wd, eno = l5.inotify_add_watch(w.fd, path, mask)
+	if not wd then return nil, eno end
+	-- the same object may have been watched under another path
+	local old = w.wdpath[wd]
+	if old and w.pathwd[old] == wd then w.pathwd[old] = nil end
+	w.wdpath[wd] = path
+	w.pathwd[path] = wd
+	return wd
+end
+
+local function addtree(w, path, found)
+	-- watch path and, in recursive mode, its subdirectories.
+	-- if found is provided, the paths found in the tree are 
+	-- appended to it as {path, isdirflag} (used to report the
+	-- content of a new directory populated before it is watched)
+	local wd, eno = addwatch(w, path)
+	if not wd then return nil, eno end
+	if not w.recursive then return true end
+	-- errors in subdirectories are ignored (they may have been 
+	-- removed in the meantime)
+	fs.dirmap(path, function(fname, ftype)
+		local p = fs.makepath(path, fname)
+		local d = isdir(p, ftype)
+		if found then insert(found, {p, d}) end
+		if d then addtree(w, p, found) end
+		return true
+	end)
+	return true
+end
+
+local function intree(p, path)
+	-- true if p is path or is under path
+	return p == path or p:sub(1, #path + 1) == path .. "/"
+end
+
+local function rmtree(w, path, rmflag)
+	-- forget the watches for path and its subdirectories
+	-- if rmflag is true, also remove the kernel watches
+	for p, wd in pairs(w.pathwd) do
+		if intree(p, path) then
+			if rmflag then l5.inotify_rm_watch(w.fd, wd) end
+			w.pathwd[p] = nil
+			w.wdpath[wd] = nil
+		end
+	end
+end
+
+local function renametree(w, from, to)
+	-- a watched directory has been moved within the watched tree
+	local moved = {}
+	for p, wd in pairs(w.pathwd) do
+		if intree(p, from) then insert(moved, {p, wd}) end
+	end
+	for i, e in ipairs(moved) do
+		local p = to .. e[1]:sub(#from + 1)
+		w.pathwd[e[1]] = nil
+		w.pathwd[p] = e[2]
+		w.wdpath[e[2]] = p
+	end
+end
+
+local function emitpending(w, out, pe)
+	w.pending[pe.path] = nil
+	pe.done = true
+	insert(out, {path=pe.path, mask=pe.mask, count=pe.count})
+end
+
+local function queue(w, out, path, mask, t)
+	-- coalesce or emit an event
+	local pe = w.pending[path]
+	if w.window > 0 and (mask & ~(w.coalesce | IN.IN_ISDIR)) == 0 then
+		if pe then
+			pe.mask = pe.mask | mask
+			pe.count = pe.count + 1
+		else
+			pe = {path=path, mask=mask, count=1, time=t}
+			w.pending[path] = pe
+			insert(w.pendq, pe)
+		end
+		return
+	end
+	-- not coalesced. emit first the pending event for the 
+	-- same path, to keep the events in order.
+	if pe then emitpending(w, out, pe) end
+	insert(out, {path=path, mask=mask, count=1})
+end
+
+local function flush(w, out, t)
+	-- emit the pending events that are ready at time t.
+	-- (all of them if t is nil). pendq is in time order.
+	local q, i = w.pendq, 1
+	while q[i] and (q[i].done or not t or q[i].time + w.window <= t) do
+		if not q[i].done then emitpending(w, out, q[i]) end
+		i = i + 1
+	end
+	if i > 1 then 
+		local n = #q
+		table.move(q, i, n, 1)
+		for j = n - i + 2, n do q[j] = nil end
+	end
+	return out
+end
+
+function inotify.new(opt)
+	opt = opt or {}
+	local fd, eno = l5.inotify_init(IN_NONBLOCK | IN_CLOEXEC)
+	if not fd then return nil, errm(eno, "inotify_init") end
+	local w = {
+		fd = fd,
+		recursive = opt.recursive,
+		mask = opt.mask or inotify.DEFAULT_MASK,
+		window = opt.window or 0,
+		coalesce = opt.coalesce or 
+			(IN.IN_MODIFY | IN.IN_ATTRIB | IN.IN_CLOSE_WRITE),
+		wdpath = {},	-- wd => path
+		pathwd = {},	-- path => wd
+		pending = {},	-- path => pending coalesced event
+		pendq = {},	-- pending coalesced events in time order
+	}
+	return w
+end
+
+function inotify.add(w, path)
+	local r, eno = addtree(w, path)
+	if not r then return nil, errm(eno, "inotify_add_watch") end
+	return true
+end
+
+function inotify.remove(w, path)
+	-- remove the watch for path (and its subdirectories in 
+	-- recursive mode)
+	if w.recursive then 
+		rmtree(w, path, true)
+	elseif w.pathwd[path] then
+		l5.inotify_rm_watch(w.fd, w.pathwd[path])
+		w.wdpath[w.pathwd[path]] = nil
+		w.pathwd[path] = nil
+	end
+	return true
+end
+
+function inotify.read(w)
+	local evl, eno = l5.inotify_read(w.fd)
+	if not evl then
+		if eno ~= EAGAIN then return nil, errm(eno, "inotify_read") end
+		evl = {}
+	end
+	local out = {}
+	local t = msnow()
+	local moves = {} -- cookie => path of a directory moved from
+	for i, e in ipairs(evl) do
+		local wd, mask, cookie, name = e[1], e[2], e[3], e[4]
+		local dir = w.wdpath[wd]
+		if mask & IN.IN_Q_OVERFLOW ~= 0 then
+			insert(out, {mask=mask, count=1})
+		elseif dir then
+			local path = name and fs.makepath(dir, name) or dir
+			if mask & IN.IN_IGNORED ~= 0 then 
+				-- the watch has been removed (object deleted,
+				-- fs unmounted or inotify_rm_watch)
+				w.wdpath[wd] = nil
+				if w.pathwd[dir] == wd then w.pathwd[dir] = nil end
+			else
+				queue(w, out, path, mask, t)
+			end
+			if w.recursive and name and (mask & IN.IN_ISDIR ~= 0) then
+				local found
+				if mask & IN.IN_MOVED_FROM ~= 0 then
+					moves[cookie] = path
+				elseif mask & IN.IN_MOVED_TO ~= 0 
+					and moves[cookie] then
+					renametree(w, moves[cookie], path)
+					moves[cookie] = nil
+				elseif mask & (IN.IN_CREATE | IN.IN_MOVED_TO) ~= 0 then
+					-- new directory. report its content
+					-- (created before the watch was added)
+					found = {}
+					addtree(w, path, found)
+				end
+				for j, f in ipairs(found or {}) do
+					queue(w, out, f[1], IN.IN_CREATE 
+						| (f[2] and IN.IN_ISDIR or 0), t)
+				end
+			end
+		end
+	end
+	-- directories moved out of the watched tree
+	for cookie, path in pairs(moves) do rmtree(w, path, true) end
+	return flush(w, out, t)
+end
+
+function inotify.timeout(w)
+	for i, pe in ipairs(w.pendq) do
+		if not pe.done then
+			local ms = pe.time + w.window - msnow()
+			return (ms > 0) and ms or 0
+		end
+	end
+	return -1
+end
+
+function inotify.flush(w)
+	return flush(w, {})
+end
+
+function inotify.close(w)
+	w.pathwd, w.wdpath, w.pending, w.pendq = {}, {}, {}, {}
+	return l5.close(w.fd)
+end
+
+
+------------------------------------------------------------------------
+return inotify
@@ -116,6 +116,251 @@ function netif.getmac(fd, ifname, intflag)
 	return concat(t, ":")
 end
 
+------------------------------------------------------------------------
+-- rtnetlink
+--
+-- a netlink socket allows to dump all links and addresses (IPv4 and
+-- IPv6) with one request each, and to subscribe to link and address
+-- change events (see man rtnetlink(7)).
+-- 
+-- link and address messages are decoded as tables:
+--   link: { event="newlink"|"dellink", index=, name=, flags=, up=,
+--	     mtu=, mac= }
+--   addr: { event="newaddr"|"deladdr", index=, family=, 
+--	     addr=, prefixlen=, scope=, label= }
+--   (addr is a printable address, eg. "10.0.0.1" or "fe80::1")
+--
+-- Note: use distinct sockets for dumps and for subscriptions, so that
+-- events are not mixed with dump results.
+
+local AF_NETLINK = 16
+local SOCK_RAW = 3
+local SOCK_CLOEXEC = 0x80000
+local NETLINK_ROUTE = 0
+local MSG_DONTWAIT = 0x40
+local EAGAIN = 11
+
+local NLBUFSIZE = 32768  -- recv buffer size (a dump datagram can be
+			 -- larger than the default l5 BUFSIZE)
+
+-- multicast groups for netif.nlopen()
+netif.RTMGRP_LINK = 0x1
+netif.RTMGRP_IPV4_IFADDR = 0x10
+netif.RTMGRP_IPV6_IFADDR = 0x100
+
+local NLMSG_ERROR, NLMSG_DONE = 2, 3
+local RTM_NEWLINK, RTM_DELLINK, RTM_GETLINK = 16, 17, 18
+local RTM_NEWADDR, RTM_DELADDR, RTM_GETADDR = 20, 21, 22
+local NLM_F_REQUEST, NLM_F_DUMP = 0x1, 0x300
+local NLHDRLEN = 16	-- sizeof(struct nlmsghdr)
+
+local IFLA_ADDRESS, IFLA_IFNAME, IFLA_MTU = 1, 3, 4
+local IFA_ADDRESS, IFA_LOCAL, IFA_LABEL = 1, 2, 3
+
+local nlsa = spack("<HHI4I4", AF_NETLINK, 0, 0, 0) -- the kernel
+local nlseq = 0
+
+local function ip6str(a)
+	-- printable form of a 16-byte ipv6 address 
+	-- (the longest run of zero groups is replaced with "::")
+	local g = { sunpack(">I2I2I2I2I2I2I2I2", a) }
+	local bi, bn, ci, cn = 0, 0, 0, 0
+	for i = 1, 8 do
+		if g[i] == 0 then
+			if cn == 0 then ci = i end
+			cn = cn + 1
+			if cn > bn then bi, bn = ci, cn end
+		else
+			cn = 0
+		end
+	end
+	local t = {}
+	for i = 1, 8 do t[i] = strf("%x", g[i]) end
+	if bn < 2 then return concat(t, ":") end
+	return concat(t, ":", 1, bi - 1) .. "::" 
+		.. concat(t, ":", bi + bn, 8)
+end
+
+local function addrstr(a)
+	if #a == 4 then return strf("%d.%d.%d.%d", a:byte(1, 4)) end
+	if #a == 16 then return ip6str(a) end
+	return nil
+end
+
+local function macstr(a)
+	local t = {}
+	for i = 1, #a do insert(t, strf("%02x", a:byte(i))) end
+	return concat(t, ":")
+end
+
+local function nlattrs(s, i, j)
+	-- parse the list of struct rtattr in s[i..j]
+	-- return a table attribute type => attribute value (a string)
+	local t = {}
+	local len, typ
+	while i + 3 <= j do
+		len, typ = sunpack("<I2I2", s, i)
+		if len < 4 then break end
+		t[typ] = s:sub(i + 4, i + len - 1)
+		i = i + ((len + 3) & ~3)
+	end
+	return t
+end
+
+local function nllink(s, i, j, typ)
+	-- struct ifinfomsg at s[i], followed by attributes
+	local family, iftype, index, flags = sunpack("<BxI2i4I4", s, i)
+	local a = nlattrs(s, i + 16, j)
+	return {
+		event = (typ == RTM_NEWLINK) and "newlink" or "dellink",
+		index = index,
+		flags = flags,
+		up = (flags & 1) ~= 0,  -- IFF_UP
+		name = a[IFLA_IFNAME] and sunpack("z", a[IFLA_IFNAME]),
+		mtu = a[IFLA_MTU] and sunpack("<I4", a[IFLA_MTU]),
+		mac = a[IFLA_ADDRESS] and macstr(a[IFLA_ADDRESS]),
+	}
+end
+
+local function nladdr(s, i, j, typ)
+	-- struct ifaddrmsg at s[i], followed by attributes
+	local family, prefixlen, flags, scope, index = 
+		sunpack("<BBBBI4", s, i)
+	local a = nlattrs(s, i + 8, j)
+	-- for ipv4, IFA_ADDRESS is the peer address on point-to-point
+	-- links. IFA_LOCAL is the local address.
+	local addr = a[IFA_LOCAL] or a[IFA_ADDRESS]
+	return {
+		event = (typ == RTM_NEWADDR) and "newaddr" or "deladdr",
+		index = index,
+		family = family,
+		addr = addr and addrstr(addr),
+		prefixlen = prefixlen,
+		scope = scope,
+		label = a[IFA_LABEL] and sunpack("z", a[IFA_LABEL]),
+	}
+end
+
+local function nlparse(s, msgs)
+	-- parse the netlink messages in datagram s. decoded link and
+	-- address messages are appended to list msgs.
+	-- return msgs, done (true if NLMSG_DONE was found)
+	-- or nil, errno if a NLMSG_ERROR message was found
+	local i, j, len, typ = 1
+	local done = false
+	while i + NLHDRLEN - 1 <= #s do
+		len, typ = sunpack("<I4I2", s, i)
+		if len < NLHDRLEN then break end
+		j = i + len - 1  -- index of the last byte of the message
+		if typ == NLMSG_DONE then 
+			done = true
+		elseif typ == NLMSG_ERROR then
+			local err = sunpack("<i4", s, i + NLHDRLEN)
+			if err ~= 0 then return nil, -err end
+		elseif typ == RTM_NEWLINK or typ == RTM_DELLINK then
+			insert(msgs, nllink(s, i + NLHDRLEN, j, typ))
+		elseif typ == RTM_NEWADDR or typ == RTM_DELADDR then
+			insert(msgs, nladdr(s, i + NLHDRLEN, j, typ))
+		end
+		i = i + ((len + 3) & ~3)
+	end
+	return msgs, done
+end
+
+function netif.nlopen(groups)
+	-- open a rtnetlink socket. return the fd, or nil, errno
+	-- groups is optional. it is an OR of netif.RTMGRP_* values: 
+	-- the socket is subscribed to these multicast groups and 
+	-- receives link and address change events (see nlread())
+	local fd, eno = l5.socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, 
+		NETLINK_ROUTE)
+	if not fd then return nil, eno end
+	local r
+	r, eno = l5.bind(fd, spack("<HHI4I4", AF_NETLINK, 0, 0, groups or 0))
+	if not r then 
+		l5.close(fd)
+		return nil, eno 
+	end
+	return fd
+end
+
+local function nldump(fd, rtm, body)
+	-- send a dump request and collect all the reply messages
+	-- return the list of decoded messages or nil, errno
+	nlseq = nlseq + 1
+	local msg = spack("<I4I2I2I4I4", NLHDRLEN + #body, rtm, 
+		NLM_F_REQUEST | NLM_F_DUMP, nlseq, 0) .. body
+	local r, eno = l5.sendto(fd, msg, 0, nlsa)
+	if not r then return nil, eno end
+	local msgs, done = {}, false
+	local s
+	while not done do
+		s, eno = l5.recv(fd, 0, NLBUFSIZE)
+		if not s then return nil, eno end
+		msgs, done = nlparse(s, msgs)
+		if not msgs then return nil, done end -- here done is errno
+	end
+	return msgs
+end
+
+function netif.nllinks(fd)
+	-- dump all links (one RTM_GETLINK request)
+	-- return a list of link tables or nil, errno
+	return nldump(fd, RTM_GETLINK, spack("<BxI2i4I4I4", 0, 0, 0, 0, 0))
+end
+
+function netif.nladdrs(fd, family)
+	-- dump all addresses (one RTM_GETADDR request)
+	-- family is optional: AF_INET (2) or AF_INET6 (10). 
+	-- default is all families.
+	-- return a list of address tables or nil, errno
+	return nldump(fd, RTM_GETADDR, spack("<BBBBI4", family or 0, 0,0,0,0))
+end
+
+function netif.interfaces(fd)
+	-- return a table name => link table for all interfaces
+	-- (see nllinks()) where each link table has an additional
+	-- 'addrs' field: the list of the interface addresses 
+	-- (as "addr/prefixlen" strings)
+	-- or nil, errno
+	local links, eno = netif.nllinks(fd)
+	if not links then return nil, eno end
+	local addrs
+	addrs, eno = netif.nladdrs(fd)
+	if not addrs then return nil, eno end
+	local t, byindex = {}, {}
+	for i, l in ipairs(links) do
+		l.addrs = {}
+		byindex[l.index] = l
+		if l.name then t[l.name] = l end
+	end
+	for i, a in ipairs(addrs) do
+		local l = byindex[a.index]
+		if l and a.addr then 
+			insert(l.addrs, strf("%s/%d", a.addr, a.prefixlen))
+		end
+	end
+	return t
+end
+
+function netif.nlread(fd)
+	-- read and decode all the pending events on a subscribed 
+	-- netlink socket (see nlopen()). does not block.
+	-- return a list of link and address tables (possibly empty)
+	-- or nil, errno
+	local msgs, s, eno = {}
+	while true do
+		s, eno = l5.recv(fd, MSG_DONTWAIT, NLBUFSIZE)
+		if not s then
+			if eno == EAGAIN then break end
+			return nil, eno
+		end
+		msgs, eno = nlparse(s, msgs)
+		if not msgs then return nil, eno end
+	end
+	return msgs
+end
+
 local function test1()
 	print"test1"
 	local ifl = assert(netif.iflist(nfd))
@@ -123,9 +368,6 @@ local function test1()
 	for i, v in ipairs(ifl) do print('  -', i, v) end
 end
 
-	print("test1\n\ninterface list\n" 
-		.. map(assert(netif.iflist(nfd)), bind1(strf, "  -  %s\n")))
-	
 
 local function saip(sa) 
 	local ip, port = sock.sockaddr_ip_port(sa)
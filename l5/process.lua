@@ -21,6 +21,17 @@ run3(exe, argl, input, opt) => stdout, stderr, exitcode  or  nil, errmsg
 		the program is terminated
 	  opt.poll_timeout: poll timout in ms
 	  opt.poll_maxtimeout: total poll timeout in ms
+	  opt.cpus: list of cpus the program can run on (eg. {0, 1})
+	  opt.nice: nice value (-20 to 19)
+	  opt.sched: scheduling policy {policy, prio} 
+		(see l5.sched_setscheduler)
+	  opt.ioprio: io priority {class, level} (class: 1=realtime,
+		2=best-effort, 3=idle, level: 0-7)
+	  opt.rlimits: resource limits, a table resource => {soft, hard}
+		where resource is a name in process.RLIMIT ("nofile", 
+		"as", "cpu", ...) or a RLIMIT_* value. -1 is unlimited.
+	  (cpus, nice, sched, ioprio and rlimits are applied in the child
+	  process between fork and exec)
 	  
 shell1(cmd, opt) => stdout, nil, exitcode  or  nil, errmsg
 shell2(cmd, input, opt) => stdout, nil, exitcode  or  nil, errmsg
@@ -29,6 +40,10 @@ shell3(cmd, input, opt) => stdout, stderr, exitcode  or  nil, errmsg
 shell<i> are similar to run<i> functions except that the executable path and 
 argument list are replaced with a shell command.
 
+cputopology() => { {cpu=, package=, core=, node=}, ... }
+	return the topology of the online cpus, to plan worker placement
+	(see also l5.nprocs() and l5.sched_getaffinity())
+
 ]]
 
 
@@ -65,6 +80,16 @@ local EINVAL = 22
 
 local MAXINT = math.maxinteger
 
+-- resource names for opt.rlimits (see RLIMIT_* in sys/resource.h)
+local RLIMIT = {
+	cpu = 0, fsize = 1, data = 2, stack = 3, core = 4, rss = 5,
+	nproc = 6, nofile = 7, memlock = 8, as = 9, locks = 10,
+	sigpending = 11, msgqueue = 12, nice = 13, rtprio = 14,
+}
+
+local IOPRIO_WHO_PROCESS = 1
+local PRIO_PROCESS = 0
+
 ------------------------------------------------------------------------
 
 local clo = function(fd) 
@@ -72,13 +97,46 @@ local clo = function(fd)
 end
 
 
-local function spawn_child(exepath, argl, envl, pn, cd)
+local function placement(opt)
+	-- apply cpu affinity, scheduling, priorities and resource
+	-- limits to the current process (see run() options)
+	-- return true or nil, errmsg
+	local r, eno
+	if opt.cpus then
+		r, eno = l5.sched_setaffinity(0, opt.cpus)
+		if not r then return nil, errm(eno, "sched_setaffinity") end
+	end
+	if opt.sched then
+		r, eno = l5.sched_setscheduler(0, opt.sched[1], opt.sched[2])
+		if not r then return nil, errm(eno, "sched_setscheduler") end
+	end
+	if opt.nice then
+		r, eno = l5.setpriority(PRIO_PROCESS, 0, opt.nice)
+		if not r then return nil, errm(eno, "setpriority") end
+	end
+	if opt.ioprio then
+		r, eno = l5.ioprio_set(IOPRIO_WHO_PROCESS, 0, 
+			opt.ioprio[1], opt.ioprio[2])
+		if not r then return nil, errm(eno, "ioprio_set") end
+	end
+	for res, lim in pairs(opt.rlimits or {}) do
+		res = RLIMIT[res] or res
+		r, eno = l5.prlimit(0, res, lim[1], lim[2])
+		if not r then return nil, errm(eno, "prlimit") end
+	end
+	return true
+end
+
+local function spawn_child(exepath, argl, envl, pn, opt)
 	-- pn is the number of pipes
 	--	1 for child stdout
 	--	2 for child stdin, stdout
 	-- 	3 for child stdin, stdout, stderr
-	-- if cd is provided, the child process changes its working 
-	--   directory to cd
+	-- opt is the run() option table. 
+	-- if opt.cd is provided, the child process changes its working 
+	--   directory to opt.cd
+	-- cpu affinity, scheduling, priorities and resource limits in
+	--   opt are applied to the child process (see placement())
 	-- return child pid, cin, cout, cerr  or nil, errmsg
 	-- cin, cout, cerr are always returned. They may be nil if not 
 	-- required according to pn.
@@ -86,6 +144,8 @@ local function spawn_child(exepath, argl, envl, pn, cd)
 	--	99 exec failed
 	--	98 chdir failed
 	--	97 pipe dup2 failed
+	--	96 placement (affinity, priority or rlimit) failed
+	local cd = opt.cd
 
 	-- create pipes:  
 	-- cin is child stdin, cout is child stdout, cerr is child stderr
@@ -123,6 +183,7 @@ local function spawn_child(exepath, argl, envl, pn, cd)
 			-- if chdir fails, not much to do. just exit(98)
 			r = l5.chdir(cd) or os.exit(98)
 		end
+		r = placement(opt) or os.exit(96)
 		clo(cin1)  -- close unused ends
 		clo(cout0)
 		clo(cerr0)
@@ -286,7 +347,7 @@ local function run(exepath, argl, input_str, opt, pn)
 	-- create pipes:  cin is child stdin, cout is child stdout,
 	-- cerr is child stderr. pipes are non-blocking.
 	local pid, cin, cout, cerr = spawn_child(
-		exepath, argl, envl, pn, opt.cd
+		exepath, argl, envl, pn, opt
 		)
 	if not pid then return nil, cin end --here cin is the errmsg
 	
@@ -396,6 +457,44 @@ local function shell3(cmd, instr, opt)
 end
 
 
+------------------------------------------------------------------------
+-- cpu topology
+
+local function cputopology()
+	-- return a list of the online cpus: {cpu=, package=, core=, node=}
+	-- (package is the physical socket, node the NUMA node - nil if
+	-- the kernel has no NUMA support)
+	local cpudir = "/sys/devices/system/cpu"
+	local tl = {}
+	local online = util.fget(cpudir .. "/online") or ""
+	local function num(path) 
+		return tonumber(util.strip(util.fget(path) or ""))
+	end
+	-- online is a list of ranges, eg. "0-3,6,8-11"
+	for range in online:gmatch("[^,%s]+") do
+		local a, b = range:match("^(%d+)-?(%d*)$")
+		a = tonumber(a) or 0
+		b = tonumber(b) or a
+		for cpu = a, b do
+			local dp = strf("%s/cpu%d", cpudir, cpu)
+			local t = {
+				cpu = cpu,
+				package = num(dp .. 
+					"/topology/physical_package_id"),
+				core = num(dp .. "/topology/core_id"),
+			}
+			-- the NUMA node is given by a "nodeN" link
+			fs.dirmap(dp, function(fname)
+				local n = fname:match("^node(%d+)$")
+				if n then t.node = tonumber(n) end
+				return true
+			end)
+			insert(tl, t)
+		end
+	end
+	return tl
+end
+
 ------------------------------------------------------------------------
 local process = {
 	run1 = run1,
@@ -404,6 +503,8 @@ local process = {
 	shell1 = shell1,
 	shell2 = shell2,
 	shell3 = shell3,
+	cputopology = cputopology,
+	RLIMIT = RLIMIT,
 }
 
 return process
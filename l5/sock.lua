@@ -94,8 +94,21 @@ local SOCK_NONBLOCK = 0x0800
 
 local EAGAIN = 11 -- same as EWOULDBLOCK (on linux and any recent unix)
 local EBUSY = 16
+local EINPROGRESS = 115
+local ENOBUFS = 105
+
+local SOL_SOCKET = 1
+local SO_ERROR = 4
+local IPPROTO_TCP = 6
+local TCP_FASTOPEN_CONNECT = 30
+
+local POLLOUT = 0x04
+
+-- sockets closed with zero-copy sends not yet completed (see close())
+local zclingering = {}
 
 sock.EAGAIN = EAGAIN
+sock.EINPROGRESS = EINPROGRESS
 sock.EOF     = 0x10000	-- outside of the range of errno numbers
 sock.TIMEOUT = 0x10001	
 
@@ -138,10 +151,16 @@ function sock.sbind(sa, nonblocking, backlog)
 	return so
 end
 
-function sock.sconnect(sa, nonblocking)
+function sock.sconnect(sa, nonblocking, fastopen)
 	-- create a stream socket object, and connect it to server 
 	-- address sa. sa is a sockaddr string
-	-- if nonblocking is true, the socket is non-blocking
+	-- if nonblocking is true, the socket is non-blocking. The 
+	-- connection may then be still in progress when sconnect()
+	-- returns: so.connecting is true, the socket becomes writable
+	-- when the connection is completed or has failed, and the 
+	-- result is given by sock.connected(so).
+	-- if fastopen is true, TCP fast open is used: the first data 
+	-- written is sent with the SYN (if the server supports it)
 	-- default options: CLOEXEC, blocking
 	-- return the socket object, or nil, eno, errmsg
 	local so = { 
@@ -156,11 +175,44 @@ function sock.sconnect(sa, nonblocking)
 	if not fd then return nil, eno, "socket" end
 	so.fd = fd
 	local r
+	if fastopen then
+		r, eno = l5.setsockopt(fd, IPPROTO_TCP, 
+			TCP_FASTOPEN_CONNECT, 1)
+		if not r then 
+			l5.close(fd)
+			return nil, eno, "setsockopt" 
+		end
+	end
 	r, eno = l5.connect(fd, sa)
-	if not r then return nil, eno, "connect" end
+	if not r then 
+		if nonblocking and eno == EINPROGRESS then
+			so.connecting = true
+		else
+			l5.close(fd)
+			return nil, eno, "connect" 
+		end
+	end
 	return so
 end
 
+function sock.connected(so, timeout)
+	-- complete a non-blocking connect (see sconnect())
+	-- wait at most timeout ms (defaults to 0) for the connection.
+	-- return true if the socket is connected, nil, EINPROGRESS if
+	-- the connection is still in progress, or nil, eno if the
+	-- connection has failed.
+	if not so.connecting then return true end
+	local n, eno = l5.poll({(so.fd << 32) | (POLLOUT << 16)}, 
+		timeout or 0)
+	if not n then return nil, eno end
+	if n == 0 then return nil, EINPROGRESS end
+	local r, eno = l5.getsockopt(so.fd, SOL_SOCKET, SO_ERROR)
+	if not r then return nil, eno end
+	if r ~= 0 then return nil, r end
+	so.connecting = nil
+	return true
+end
+
 function sock.dsocket(family, nonblocking)
 	-- create a datagram socket object, return the fd
 	-- family is 1 (unix), 2 (ip4) or 10 (ip6)
@@ -206,6 +258,22 @@ function sock.sendto(so, msg, dest_sa)
 end
 
 function sock.close(so) 
+	if so.rdr then 
+		l5.rdr_free(so.rdr)
+		so.rdr = nil
+	end
+	if so.zc and sock.zcreap(so) ~= 0 then
+		-- zero-copy sends are not completed. The data must stay
+		-- referenced until the kernel has sent it (TCP keeps 
+		-- sending after close()), and the completions can only be
+		-- read on the socket: the socket is closed later by 
+		-- zclinger(). The write side is shut down now so that 
+		-- the peer gets EOF.
+		l5.shutdown(so.fd)
+		zclingering[so] = true
+		return true
+	end
+	so.zc = nil
 	return l5.close(so.fd)
 end
 
@@ -231,61 +299,53 @@ function sock.accept(so, nonblocking)
 	return cso
 end
 
--- sock readbytes and readline functions: at the moment not very efficient
--- (concat read string with buffer at each read operation - should
--- replace the buf string with a table) -- to be optimized later! 
+-- buffered read functions
+-- they use a native stream reader bound to the socket fd (see 
+-- l5.rdr_* functions). The reader is created at the first buffered 
+-- read. On a non-blocking socket, they return nil, EAGAIN when more 
+-- input is needed. The bytes already received are kept in the reader
+-- buffer. At end of file, they return nil, sock.EOF
+
+local function reader(so)
+	local rdr = so.rdr
+	if not rdr then
+		rdr = l5.rdr_new(so.fd)
+		so.rdr = rdr
+	end
+	return rdr
+end
 
 function sock.readline(so)
 	-- buffered read. read a line
 	-- return line (without eol) or nil, errno
-	local eno -- errno
-	so.buf = so.buf or "" -- read buffer
---~ 	so.bi = so.bi or 1 -- buffer index
-	while true do
-		local i, j = so.buf:find("\r?\n")
-		if i then -- NL found. return the line
-			local l = so.buf:sub(1, i-1)
-			so.buf = so.buf:sub(j + 1)
-			return l
-		else -- NL not found. read more bytes into buf
-			local b, eno = l5.read(so.fd)
-			if not b then
-				return nil, eno
-			end
---~ 				print("READ", b and #b)
-			if #b == 0 then return nil, sock.EOF end
-			so.buf = so.buf .. b
-		end--if
-	end--while reading a line
+	return l5.rdr_readline(so.rdr or reader(so))
 end
 
 function sock.readbytes(so, n)
 	-- buffered read: read n bytes
-	-- return read bytes as a string, or nil, errmsg
-	so.buf = so.buf or "" -- read buffer
-	local nbs -- "n bytes string" -- expected result
-	local eno -- errno
-	while true do
-		if n <= #so.buf then -- enough bytes in buf
-			nbs = so.buf:sub(1, n)
-			-- keep not needed bytes in buf
-			so.buf = so.buf:sub(n+1)
-			return nbs
-		else -- not enough, read more
-			local b, eno = l5.read(so.fd)
-			if not b then
-				return nil, eno
-			end
-			if #b == 0 then
-				--EOF, not enough bytes
-				-- return what we have
-				nbs = buf
-				so.buf = ""
-				return nbs
-			end
-			so.buf = so.buf .. b
-		end
-	end--while reading n bytes
+	-- return read bytes as a string, or nil, errno
+	-- (at EOF, return the available bytes if less than n)
+	return l5.rdr_readbytes(so.rdr or reader(so), n)
+end
+
+function sock.readuntil(so, delim)
+	-- buffered read: read until string delim
+	-- return read bytes (without delim) as a string, or nil, errno
+	return l5.rdr_readuntil(so.rdr or reader(so), delim)
+end
+
+function sock.readframe(so, hlen, le)
+	-- buffered read: read a length-prefixed frame
+	-- hlen is the size of the length header (1, 2, 4 or 8 - 
+	-- defaults to 4). the length is big-endian unless le is true.
+	-- return the frame payload as a string, or nil, errno
+	return l5.rdr_readframe(so.rdr or reader(so), hlen, le)
+end
+
+function sock.buffered(so)
+	-- return the number of bytes received and not yet read
+	-- by the buffered read functions
+	return so.rdr and l5.rdr_buffered(so.rdr) or 0
 end
 
 sock.read = sock.readbytes  -- define a common alias
@@ -316,6 +376,206 @@ function sock.getsockname(so)
 	return l5.getsockname(so.fd) 
 end
 
+------------------------------------------------------------------------
+-- zero-copy send (MSG_ZEROCOPY)
+--
+-- with zero-copy, the kernel sends the bytes directly from the Lua 
+-- string (or buffer) instead of copying them in the socket buffer. 
+-- The data must then stay alive and unchanged until the kernel 
+-- reports the completion of the send in the socket error queue. 
+-- zcsend() keeps a reference to the data in so.zc.pinned, and 
+-- zcreap() releases the completed sends. The socket is reported with
+-- POLLERR when completions are available.
+-- A socket closed with sends not yet completed is kept open (write
+-- side shut down) until zclinger() has reaped all its completions.
+-- Zero-copy is only worth it for large sends (see sock.ZCMIN). When 
+-- the kernel reports that it has copied the data anyway (eg. on 
+-- loopback or with a device without scatter-gather), zcsend() falls 
+-- back to regular sends.
+
+local SO_ZEROCOPY = 60
+local MSG_ZEROCOPY = 0x4000000
+
+sock.ZCMIN = 16384	-- smaller sends are always copied
+sock.ZCCOPIED = 8	-- fall back to regular sends after this number 
+			-- of consecutive completions copied by the kernel
+
+function sock.zerocopy(so)
+	-- enable zero-copy sends on a stream socket
+	-- return true or nil, errno (eg. if the kernel doesn't support
+	-- SO_ZEROCOPY. zcsend() is then a regular send())
+	sock.zclinger()
+	local r, eno = l5.setsockopt(so.fd, SOL_SOCKET, SO_ZEROCOPY, 1)
+	if not r then return nil, eno end
+	so.zc = { 
+		seq = 0,	-- kernel number of the next zero-copy send
+		pinned = {},	-- seq => data
+		npinned = 0,
+		ncopied = 0,	-- consecutive copied completions
+		fallback = false,
+	}
+	return true
+end
+
+function sock.zcsend(so, data, idx, count)
+	-- send count bytes of data starting at index idx
+	-- data is a string or a buffer (see l5.buf_new()). A buffer
+	-- must not be modified, resized or freed until the send is 
+	-- completed (see zcpending())
+	-- idx, count default to 1, #data
+	-- return the number of bytes sent or nil, errno
+	local zc = so.zc
+	local len = count or ((type(data) == "string" and #data 
+		or l5.buf_size(data)) - (idx or 1) + 1)
+	if not zc or zc.fallback or len < sock.ZCMIN then 
+		return l5.send(so.fd, data, 0, idx, count)
+	end
+	local n, eno = l5.send(so.fd, data, MSG_ZEROCOPY, idx, count)
+	if not n then
+		if eno ~= ENOBUFS then return nil, eno end
+		-- too many pending notifications (optmem limit):
+		-- process them, and copy this one.
+		sock.zcreap(so)
+		return l5.send(so.fd, data, 0, idx, count)
+	end
+	zc.pinned[zc.seq] = data
+	zc.npinned = zc.npinned + 1
+	zc.seq = (zc.seq + 1) & 0xffffffff
+	return n
+end
+
+function sock.zcreap(so)
+	-- process the zero-copy completion notifications, and release
+	-- the data of the completed sends
+	-- return the number of sends not yet completed, or nil, errno
+	local zc = so.zc
+	if not zc then return 0 end
+	local nl, eno = l5.zc_reap(so.fd)
+	if not nl then return nil, eno end
+	local pinned = zc.pinned
+	local function release(lo, hi)
+		for i = lo, hi do
+			if pinned[i] ~= nil then
+				pinned[i] = nil
+				zc.npinned = zc.npinned - 1
+			end
+		end
+	end
+	for _, nt in ipairs(nl) do
+		local lo, hi, copied = nt[1], nt[2], nt[3]
+		if hi >= lo then 
+			release(lo, hi)
+		else -- the 32-bit counter has wrapped around
+			release(lo, 0xffffffff)
+			release(0, hi)
+		end
+		if copied then 
+			zc.ncopied = zc.ncopied + 1
+			if zc.ncopied >= sock.ZCCOPIED then 
+				zc.fallback = true 
+			end
+		else
+			zc.ncopied = 0
+		end
+	end
+	return zc.npinned
+end
+
+function sock.zclinger()
+	-- reap the completions of the sockets closed with zero-copy
+	-- sends pending, and close the sockets whose sends are all
+	-- completed. (it is called by zerocopy(). An event loop using 
+	-- zero-copy should call it periodically)
+	-- return the number of sockets still lingering
+	local n = 0
+	for so in pairs(zclingering) do
+		local r = sock.zcreap(so)
+		-- (on error, the socket is unusable: just close it)
+		if r == 0 or not r then
+			zclingering[so] = nil
+			so.zc = nil
+			l5.close(so.fd)
+		else
+			n = n + 1
+		end
+	end
+	return n
+end
+
+function sock.zcpending(so)
+	-- return the number of zero-copy sends not yet completed
+	return so.zc and so.zc.npinned or 0
+end
+
+------------------------------------------------------------------------
+-- fd passing over unix sockets (SCM_RIGHTS, SCM_CREDENTIALS)
+--
+-- a connected socket (eg. an accepted client socket, or a listening 
+-- socket) can be handed off to another process with sendfds(). 
+-- The fds received with recvfds() are new fds in the receiving 
+-- process. They refer to the same open sockets/files. The sender
+-- usually closes its own fds after sending them.
+
+local MSG_CMSG_CLOEXEC = 0x40000000
+local MSG_CTRUNC = 8
+local SO_PASSCRED = 16
+
+function sock.pair(stream, nonblocking)
+	-- create a pair of connected unix socket objects
+	-- if stream is true, the sockets are stream sockets, else 
+	-- they are datagram sockets.
+	-- return so0, so1 or nil, eno
+	local sotype = (stream and SOCK_STREAM or SOCK_DGRAM) | SOCK_CLOEXEC
+	if nonblocking then sotype = sotype | SOCK_NONBLOCK end
+	local fd0, fd1 = l5.socketpair(AF_UNIX, sotype, 0)
+	if not fd0 then return nil, fd1 end -- here fd1 is the errno
+	local function so(fd) 
+		return { fd = fd, nonblocking = nonblocking, 
+			stream = stream, family = AF_UNIX, }
+	end
+	return so(fd0), so(fd1)
+end
+
+function sock.passcred(so)
+	-- allow the socket to receive the peer credentials 
+	-- (see sendfds() and recvfds())
+	return l5.setsockopt(so.fd, SOL_SOCKET, SO_PASSCRED, 1)
+end
+
+function sock.sendfds(so, fdl, msg, cred)
+	-- send a list of fds (at most 64) over a unix socket
+	-- msg is an optional string sent with the fds (eg. a description
+	-- of the fds). it defaults to "\0" (a stream socket requires
+	-- at least one byte of data)
+	-- if cred is true, the process credentials are also sent
+	-- (the receiver must have called passcred())
+	-- return number of bytes sent or nil, errno
+	if msg == nil or msg == "" then msg = "\0" end
+	return l5.sendmsg(so.fd, msg, 0, fdl, cred)
+end
+
+function sock.recvfds(so, bufsize)
+	-- receive fds sent by the peer with sendfds()
+	-- the received fds have the close-on-exec flag set
+	-- return fdlist, msg, cred or nil, errno
+	--   fdlist is the list of received fds (may be empty)
+	--   msg is the string sent with the fds
+	--   cred is the peer credentials {pid=, uid=, gid=} or nil
+	-- at end of file, return nil, sock.EOF
+	-- if more fds were sent than can be received at once (64), 
+	-- return nil, ENOBUFS (all the fds of the message are closed)
+	local msg, fdl, cred, mflags = l5.recvmsg(
+		so.fd, MSG_CMSG_CLOEXEC, bufsize)
+	if not msg then return nil, fdl end
+	if mflags & MSG_CTRUNC ~= 0 then
+		-- some fds could not be received. don't leak the others.
+		for _, fd in ipairs(fdl) do l5.close(fd) end
+		return nil, ENOBUFS
+	end
+	if #msg == 0 and #fdl == 0 then return nil, sock.EOF end
+	return fdl, msg, cred
+end
+
 
 --[[     ???  MUST TCP WRITE BE BUFFERED ???
 
@@ -71,6 +71,76 @@ function tty.restoremode()
 	return tty.setmode(tty.initialmode)
 end
 
+------------------------------------------------------------------------
+-- terminal screen and keys
+-- (see the term_* functions in l5.c)
+--
+--	t = tty.term_open()
+--	l5.term_clear(t.term)
+--	l5.term_put(t.term, row, col, "hello", tty.attr(3, nil, tty.BOLD))
+--	l5.term_flush(t.term)  -- update the screen in one write()
+--	-- poll fd 0 and t.winchfd, then
+--	keys = l5.term_readkeys(t.term)
+--	-- or, if t.winchfd is readable:
+--	rows, cols = tty.term_checksize(t)
+--	...
+--	tty.term_close(t)
+
+-- cell attribute flags
+tty.BOLD = 1 << 18
+tty.UNDERLINE = 1 << 19
+tty.REVERSE = 1 << 20
+
+function tty.attr(fg, bg, flags)
+	-- return a cell attribute
+	-- fg and bg are 256-color indices (0-255), or nil for the 
+	-- default color. flags is an OR of tty.BOLD, UNDERLINE, REVERSE
+	return (fg and fg + 1 or 0) | ((bg and bg + 1 or 0) << 9) 
+		| (flags or 0)
+end
+
+function tty.term_open()
+	-- set the tty in non-blocking raw mode, switch to the alternate 
+	-- screen and enable bracketed paste.
+	-- return a terminal object t or nil, errmsg
+	--   t.term is the l5 terminal (input is fd 0, output is fd 1)
+	--   t.winchfd is readable when the terminal is resized
+	local rows, cols = l5.term_getsize(1)
+	if not rows then return nil, errm(cols, "term_getsize") end
+	local winchfd, eno = l5.term_winchfd()
+	if not winchfd then return nil, errm(eno, "term_winchfd") end
+	local t = { 
+		term = l5.term_new(0, 1, rows, cols), 
+		winchfd = winchfd, 
+		rows = rows, 
+		cols = cols,
+	}
+	tty.setrawmode(true)
+	l5.write(1, "\27[?1049h\27[?2004h")
+	return t
+end
+
+function tty.term_checksize(t)
+	-- drain the winch fd. if the terminal size has changed, resize 
+	-- the screen (it is fully redrawn at next flush)
+	-- return rows, cols
+	while l5.read(t.winchfd) do end
+	local rows, cols = l5.term_getsize(1)
+	if rows and (rows ~= t.rows or cols ~= t.cols) then
+		l5.term_resize(t.term, rows, cols)
+		t.rows, t.cols = rows, cols
+	end
+	return t.rows, t.cols
+end
+
+function tty.term_close(t)
+	-- disable bracketed paste, restore the main screen, the cursor
+	-- and the initial tty mode
+	l5.write(1, "\27[?2004l\27[?1049l\27[?25h")
+	tty.restoremode()
+	l5.term_free(t.term)
+end
+
 
 ------------------------------------------------------------------------
 return tty	
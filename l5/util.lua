@@ -2,6 +2,8 @@
 ------------------------------------------------------------------------
 -- simple utility functions
 
+local l5 = require "l5"
+
 local spack, sunpack, strf = string.pack, string.unpack, string.format
 
 util = {}
@@ -56,24 +58,26 @@ end
 	
 function util.fget(fname)
 	-- return content of file 'fname' or nil, msg in case of error
-	local f, msg, s
-	f, msg = io.open(fname, 'rb')
-	if not f then return nil, msg end
-	s, msg = f:read("*a")
-	f:close()
-	if not s then return nil, msg end
+	-- (native whole-file read. see l5.readfile)
+	local s, eno = l5.readfile(fname)
+	if not s then return nil, util.errm(eno, "fget") end
 	return s
 end
 
 function util.fput(fname, content)
 	-- write 'content' to file 'fname'
 	-- return true in case of success, or nil, msg in case of error
-	local f, msg, r
-	f, msg = io.open(fname, 'wb')
-	if not f then return nil, msg end
-	r, msg = f:write(content)
-	f:flush(); f:close()
-	if not r then return nil, msg else return true end
+	-- (native whole-file write. see l5.writefile. 
+	-- use fs.writefile for atomic or durable writes)
+	local r, eno = l5.writefile(fname, content)
+	if not r then return nil, util.errm(eno, "fput") end
+	return true
+end
+
+function util.msnow()
+	-- return the CLOCK_MONOTONIC time in ms
+	local sec, nsec = l5.clock_gettime(1)
+	return sec * 1000 + nsec // 1000000
 end
 
 
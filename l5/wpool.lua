@@ -0,0 +1,100 @@
+-- Copyright (c) 2021  Phil Leblanc  -- see LICENSE file
+------------------------------------------------------------------------
+--[[		L5 worker pool
+
+Run blocking filesystem calls in a pool of C worker threads, so that
+a slow fsync() or stat() does not stall the Lua event loop.
+
+	wp = wpool.new(nthreads)
+	id = wpool.fsync(wp, fd)  -- or open, stat, readfile, ...
+	...
+	-- wpool.fd(wp) is readable when results are available.
+	-- poll it with the other fds of the event loop, then:
+	for i, c in ipairs(wpool.collect(wp)) do
+		local id, result, eno = c[1], c[2], c[3]
+		...
+	end
+	wpool.close(wp)
+
+results:
+	open		fd
+	fsync, fdatasync, unlink, rename, mkdir	 0
+	stat		a table with the same layout as l5.lstat(path, {})
+	readdir		a list of {name, type} ("." and ".." are ignored)
+	readfile	the file content as a string
+	
+in case of error, result is nil and eno is the errno value.
+
+]]
+
+local l5 = require "l5"
+
+------------------------------------------------------------------------
+
+wpool = {}
+
+-- operation ids (see l5.c)
+wpool.OPEN = 1
+wpool.FSYNC = 2
+wpool.FDATASYNC = 3
+wpool.STAT = 4
+wpool.UNLINK = 5
+wpool.RENAME = 6
+wpool.MKDIR = 7
+wpool.READDIR = 8
+wpool.READFILE = 9
+
+local submit = l5.wpool_submit
+
+function wpool.new(nthreads)
+	-- create a pool with nthreads worker threads (defaults to 4)
+	-- return the pool or nil, errno
+	return l5.wpool_new(nthreads)
+end
+
+wpool.close = l5.wpool_close
+wpool.fd = l5.wpool_fd
+wpool.collect = l5.wpool_collect
+wpool.pending = l5.wpool_pending
+
+-- the following functions submit a request and return its id
+
+function wpool.open(wp, path, flags, mode)
+	return submit(wp, wpool.OPEN, path, flags, mode or 0)
+end
+
+function wpool.fsync(wp, fd) return submit(wp, wpool.FSYNC, fd) end
+
+function wpool.fdatasync(wp, fd) return submit(wp, wpool.FDATASYNC, fd) end
+
+function wpool.stat(wp, path, statflag)
+	-- if statflag is true, stat() is used instead of lstat()
+	return submit(wp, wpool.STAT, path, statflag and 1 or 0)
+end
+
+function wpool.unlink(wp, path) return submit(wp, wpool.UNLINK, path) end
+
+function wpool.rename(wp, oldpath, newpath)
+	return submit(wp, wpool.RENAME, oldpath, newpath)
+end
+
+function wpool.mkdir(wp, path, mode) 
+	return submit(wp, wpool.MKDIR, path, mode or 0)
+end
+
+function wpool.readdir(wp, path) return submit(wp, wpool.READDIR, path) end
+
+function wpool.readfile(wp, path) return submit(wp, wpool.READFILE, path) end
+
+function wpool.wait(wp, timeout)
+	-- wait for completed requests (at most timeout ms) and
+	-- collect them. return the list of completions (may be empty)
+	-- or nil, errno
+	local r, eno = l5.pollin(wpool.fd(wp), timeout)
+	if not r then return nil, eno end
+	return wpool.collect(wp)
+end
+
+
+------------------------------------------------------------------------
+return wpool
@@ -168,12 +168,248 @@ function test_file()
 	f:write("world!"); f:flush(); f:close()
 	assert(util.fget(fname) == rpad("hello", 20, '\0') .. "world!")
 	os.execute("rm " .. fname)
+	-- readfile, writefile
+	assert(fs.readfile("l5.c") == io.open("l5.c"):read("a"))
+	assert(not fs.readfile("/tmp/l5-no-such-file"))
+	assert(#fs.readfile("/proc/self/status") > 0)  -- st_size is 0
+	assert(fs.writefile(fname, "hello"))
+	assert(fs.readfile(fname) == "hello")
+	local big = ("0123456789abcdef"):rep(100000)
+	assert(fs.writefile(fname, big, {atomic=true, syncdir=true, 
+		mode=tonumber("600", 8), size=2*#big}))
+	assert(fs.readfile(fname) == big)
+	assert(fs.size(fname) == #big)
+	assert(fs.mpermo(fs.attr(fname, 'mode')) == "0600")
+	os.execute("rm " .. fname)
 	print("test_file: ok.")
 end
 
 
 
 
+function test_alog()
+	local alog = require "l5.alog"
+	local dn = "/tmp/l5alog"
+	os.execute("rm -rf " .. dn)
+	assert(l5.mkdir(dn, tonumber("755", 8)))
+	local lg, lastseq = assert(alog.open(dn, {segsize=4096}))
+	assert(lastseq == 0)
+	local done = 0
+	local function waiter(seq) done = done + 1 end
+	for i = 1, 100 do 
+		assert(alog.append(lg, ("record%d"):format(i), waiter))
+	end
+	assert(done == 0 and alog.timeout(lg) >= 0)
+	assert(alog.commit(lg) == 100)
+	assert(done == 100 and alog.timeout(lg) == -1)
+	-- the next commit does not fit in the 4096-byte segment: 
+	-- a new segment is started at record 101 (0x65)
+	for j = 1, 2 do
+		for i = 1, 50 do assert(alog.append(lg, ("x"):rep(20))) end
+		assert(alog.commit(lg))
+	end
+	assert(alog.close(lg))
+	assert(#fs.ls1(dn) == 2)
+	-- a torn record at the end of the log is dropped on open
+	local segname = dn .. "/0000000000000065.log"
+	local f = io.open(segname, "a")
+	f:write(string.pack("=I4I4I8", 10, 0, 201), "torn")
+	f:close()
+	lg, lastseq = assert(alog.open(dn, {segsize=4096}))
+	assert(lastseq == 200)
+	assert(alog.append(lg, "last") == 201)
+	assert(alog.close(lg))
+	local n = 0
+	assert(alog.replay(dn, function(seq, str)
+		n = n + 1
+		assert(seq == n)
+		if seq == 1 then assert(str == "record1") end
+		if seq == 201 then assert(str == "last") end
+	end))
+	assert(n == 201)
+	os.execute("rm -rf " .. dn)
+	print("test_alog: ok.")
+end
+
+------------------------------------------------------------------------
+-- test worker pool
+
+function test_wpool()
+	local wpool = require "l5.wpool"
+	local wp = assert(wpool.new(2))
+	local dn = "/tmp/l5wpd"
+	local ids = {}
+	ids.readfile = wpool.readfile(wp, "l5.c")
+	ids.stat = wpool.stat(wp, "l5.c")
+	ids.readdir = wpool.readdir(wp, "/proc/sys/net")
+	ids.mkdir = wpool.mkdir(wp, dn, tonumber("755", 8))
+	ids.nofile = wpool.stat(wp, "/tmp/l5-no-such-file")
+	assert(wpool.pending(wp) == 5)
+	local res = {}
+	local n = 0
+	while n < 5 do
+		local cl = assert(wpool.wait(wp, 1000))
+		for i, c in ipairs(cl) do res[c[1]] = c; n = n + 1 end
+	end
+	assert(wpool.pending(wp) == 0)
+	assert(res[ids.readfile][2] == util.fget("l5.c"))
+	assert(res[ids.stat][2][8] == fs.size("l5.c"))
+	local found = false
+	for i, e in ipairs(res[ids.readdir][2]) do
+		found = found or (e[1] == "ipv4" and e[2] == 4)
+	end
+	assert(found, "ipv4 not found in /proc/sys/net")
+	assert(res[ids.mkdir][2] == 0)
+	assert(res[ids.nofile][2] == nil and res[ids.nofile][3] == 2)
+	assert(l5.rmdir(dn))
+	wpool.close(wp)
+	-- the fds of uncollected opens are closed with the pool
+	local nfd = #fs.ls1("/proc/self/fd")
+	wp = assert(wpool.new(2))
+	for i = 1, 4 do wpool.open(wp, "l5.c", 0) end
+	l5.msleep(100) -- let the opens complete
+	wpool.close(wp)
+	assert(#fs.ls1("/proc/self/fd") == nfd)
+	print("test_wpool: ok.")
+end
+
+------------------------------------------------------------------------
+-- test inotify watcher
+
+function test_inotify()
+	local inotify = require "l5.inotify"
+	local dn = "/tmp/l5wt"
+	os.execute("rm -rf " .. dn .. "; mkdir " .. dn)
+	local w = assert(inotify.new{recursive=true, window=50})
+	assert(inotify.add(w, dn))
+	local function find(evl, path, mask)
+		for i, e in ipairs(evl) do
+			if e.path == path and e.mask & mask ~= 0 then
+				return e
+			end
+		end
+	end
+	-- new subdirectory and its content are reported
+	assert(l5.mkdir(dn .. "/sub", tonumber("755", 8)))
+	util.fput(dn .. "/sub/a", "a")
+	local evl = assert(inotify.read(w))
+	assert(find(evl, dn .. "/sub", inotify.IN_CREATE))
+	assert(find(evl, dn .. "/sub/a", inotify.IN_CREATE))
+	-- writes in the subdirectory are coalesced
+	local fn = dn .. "/sub/a"
+	for i = 1, 3 do util.fput(fn, "hello") end
+	evl = assert(inotify.read(w))
+	assert(not find(evl, fn, inotify.IN_CLOSE_WRITE))
+	assert(inotify.timeout(w) >= 0)
+	l5.msleep(60)
+	evl = assert(inotify.read(w))
+	local e = find(evl, fn, inotify.IN_CLOSE_WRITE)
+	assert(e and e.count > 3 and e.mask & inotify.IN_MODIFY ~= 0)
+	assert(inotify.timeout(w) == -1)
+	inotify.close(w)
+	os.execute("rm -rf " .. dn)
+	print("test_inotify: ok.")
+end
+
+------------------------------------------------------------------------
+-- test terminal key decoding and screen updates (on pipes)
+
+function test_term()
+	local O_NONBLOCK = 0x800
+	local ifd0, ifd1 = assert(l5.pipe2(O_NONBLOCK))
+	local ofd0, ofd1 = assert(l5.pipe2(O_NONBLOCK))
+	local t = l5.term_new(ifd0, ofd1, 2, 10)
+	l5.write(ifd1, "a\27[A\27[200~x\ny\27[201~\27[1;5C\3\27")
+	local kl = l5.term_readkeys(t)
+	assert(kl[1] == "a" and kl[2] == "up")
+	assert(kl[3][1] == "paste" and kl[3][2] == "x\ny")
+	assert(kl[4] == "C-right" and kl[5] == "C-c" and #kl == 5)
+	-- no more input: the pending ESC is the escape key
+	kl = l5.term_readkeys(t)
+	assert(kl[1] == "esc" and #kl == 1)
+	-- first flush: full redraw
+	l5.term_put(t, 1, 1, "hello")
+	assert(l5.term_flush(t))
+	local s = l5.read(ofd0)
+	assert(s:find("\27[2J", 1, true) and s:find("hello", 1, true))
+	-- second flush: only the changed cell
+	l5.term_put(t, 1, 2, "a", tty.attr(1, nil, tty.BOLD))
+	assert(l5.term_flush(t))
+	s = l5.read(ofd0)
+	assert(s:find("\27[1;2H\27[0;1;38;5;1ma", 1, true)) 
+	assert(not s:find("hello", 1, true))
+	l5.term_free(t)
+	l5.close(ifd0); l5.close(ifd1); l5.close(ofd0); l5.close(ofd1)
+	print("test_term: ok.")
+end
+
+function test_timerwheel()
+	local tw = l5.tw_new(16)
+	assert(l5.tw_next(tw) == -1)
+	local sec, nsec = l5.clock_gettime(1) -- CLOCK_MONOTONIC
+	local now = sec * 1000 + nsec // 1000000
+	local t1 = l5.tw_arm(tw, 100, 1)
+	local t2 = l5.tw_arm(tw, 5000, 2)
+	local t3 = l5.tw_arm(tw, 300000, 3)
+	for i = 1, 100 do l5.tw_arm(tw, 1000 + i, 100 + i) end -- grow pool
+	assert(l5.tw_count(tw) == 103)
+	assert(l5.tw_next(tw) <= 100)
+	assert(l5.tw_cancel(tw, t2))
+	assert(not l5.tw_cancel(tw, t2)) -- stale tid
+	assert(l5.tw_rearm(tw, t1, 2000))
+	assert(#l5.tw_expire(tw, now + 1000) == 0)
+	local kl = l5.tw_expire(tw, now + 1200)
+	assert(#kl == 100 and kl[1] > 100)
+	kl = l5.tw_expire(tw, now + 2100)
+	assert(#kl == 1 and kl[1] == 1)
+	assert(not l5.tw_rearm(tw, t1, 10)) -- t1 has expired
+	kl = l5.tw_expire(tw, now + 300100)
+	assert(#kl == 1 and kl[1] == 3)
+	assert(l5.tw_count(tw) == 0)
+	l5.tw_free(tw)
+	print("test_timerwheel: ok.")
+end
+
+function test_buffer()
+	local b = l5.buf_new(8, "abc")
+	assert(l5.buf_size(b) == 8)
+	assert(l5.buf_get(b) == "abc\0\0\0\0\0")
+	assert(l5.buf_set(b, 7, "xy"))
+	assert(l5.buf_get(b, 6) == "\0xy")
+	assert(l5.buf_get(b, 2, 2) == "bc")
+	assert(l5.buf_get(b, 9) == "")
+	-- out of range indices
+	assert(not pcall(l5.buf_get, b, 0))
+	assert(not pcall(l5.buf_get, b, 10))
+	assert(not pcall(l5.buf_get, b, 2, 8))
+	assert(not pcall(l5.buf_get, b, 2, -1))
+	assert(not pcall(l5.buf_set, b, 0, "x"))
+	assert(not pcall(l5.buf_set, b, -1, "xy"))
+	assert(not pcall(l5.buf_set, b, 8, "xy"))
+	assert(not pcall(l5.buf_new, 2, "abc"))
+	-- resize preserves the content and zero-fills new bytes
+	assert(l5.buf_resize(b, 10))
+	assert(l5.buf_get(b) == "abc\0\0\0xy\0\0")
+	assert(l5.buf_resize(b, 2))
+	assert(l5.buf_get(b) == "ab")
+	assert(not pcall(l5.buf_set, b, 2, "xy"))
+	l5.buf_free(b)
+	assert(l5.buf_size(b) == 0)
+	print("test_buffer: ok.")
+end
+
+function test_dm()
+	-- only the table parsing is tested (the ioctls require root)
+	local dm = require "l5.dm"
+	local tbl = "0 8 linear /dev/loop0 0\n" 
+		.. "8 eight linear /dev/loop1 0\n"  -- invalid size
+		.. "16 8 linear /dev/loop1 8\n"
+	local r, em = dm.setup("l5test", tbl)
+	assert(r == nil and em == "invalid table")
+	assert(dm.setup("l5test", " \n\n") == nil)
+	print("test_dm: ok.")
+end
+
 ------------------------------------------------------------------------
 function test_pipe2()
 	local fd0, fd1 = l5.pipe2()
@@ -205,6 +441,13 @@ test_fork()
 test_pipe2()
 test_fs()
 test_file()
+test_buffer()
+test_alog()
+test_wpool()
+test_inotify()
+test_term()
+test_timerwheel()
+test_dm()
 
 
 	
@@ -101,6 +101,26 @@ local function test_shell_opt1()
 	--
 	
 end
+local function test_placement()
+	local online = l5.nprocs()
+	assert(online >= 1)
+	local cpus = assert(l5.sched_getaffinity())
+	assert(#cpus >= 1)
+	local prio = l5.getpriority(0, 0)
+	local tl = process.cputopology()
+	assert(#tl == online)
+	-- run a child pinned on one cpu, with a lower priority and
+	-- a reduced number of open files
+	local opt = {cpus = {cpus[1]}, nice = 10, 
+		rlimits = {nofile = {64, 64}}}
+	local rout, rerr, ex = process.shell1(
+		"cat /proc/self/status | grep Cpus_allowed_list; ulimit -n", 
+		opt)
+	assert(ex == 0)
+	assert(rout == string.format("Cpus_allowed_list:\t%d\n64\n", cpus[1]))
+	assert(l5.getpriority(0, 0) == prio) -- parent is unchanged
+end
+
 print("------------------------------------------------------------")
 print("test_process...	Please ignore 'who' and 'md5sum' error messages")
 test_run1()
@@ -109,6 +129,7 @@ test_run3()
 test_shell1_2()
 test_shell3()
 test_shell_opt1()
+test_placement()
 print("")
 print("test_process ok.")
 
@@ -215,6 +215,167 @@ function test_datagram0()
 end
 
 
+function test_reader()
+	-- buffered reader on a pipe
+	local fd0, fd1 = assert(l5.pipe2())
+	local rdr = l5.rdr_new(fd0, 16)
+	local long = ("x"):rep(1000)
+	assert(l5.write(fd1, "ab\r\ncd\n" .. long .. "\nxy--zt"))
+	assert(l5.write(fd1, spack(">s2<s4", "frame1", "frame2")))
+	assert(l5.rdr_readline(rdr) == "ab")
+	assert(l5.rdr_readline(rdr) == "cd")
+	assert(l5.rdr_readline(rdr) == long)
+	assert(l5.rdr_readuntil(rdr, "--") == "xy")
+	assert(l5.rdr_readbytes(rdr, 2) == "zt")
+	assert(l5.rdr_readframe(rdr, 2) == "frame1")
+	assert(l5.rdr_readframe(rdr, 4, true) == "frame2")
+	assert(l5.rdr_buffered(rdr) == 0)
+	assert(l5.write(fd1, "end"))
+	l5.close(fd1)
+	local r, eno = l5.rdr_readline(rdr)
+	assert(not r and eno == sock.EOF)
+	assert(l5.rdr_readbytes(rdr, 10) == "end")
+	r, eno = l5.rdr_readbytes(rdr, 10)
+	assert(not r and eno == sock.EOF)
+	l5.rdr_free(rdr)
+	l5.close(fd0)
+	print("test_reader ok.")
+end
+
+function test_netlink()
+	local netif = require "l5.netif"
+	local fd = assert(netif.nlopen())
+	local ift = assert(netif.interfaces(fd))
+	local lo = assert(ift.lo, "lo not found")
+	assert(lo.up and lo.index > 0)
+	local found = false
+	for i, a in ipairs(lo.addrs) do 
+		found = found or (a == "127.0.0.1/8")
+	end
+	assert(found, "127.0.0.1/8 not found")
+	l5.close(fd)
+	-- a subscribed socket has no pending event
+	fd = assert(netif.nlopen(netif.RTMGRP_LINK))
+	local el = assert(netif.nlread(fd))
+	assert(#el == 0)
+	l5.close(fd)
+	print("test_netlink ok.")
+end
+
+function test_fdpass()
+	-- pass a pipe write end over a unix socket pair
+	local s0, s1 = assert(sock.pair(true))
+	assert(sock.passcred(s1))
+	local fd0, fd1 = assert(l5.pipe2())
+	assert(sock.sendfds(s0, {fd1}, "pipe", true))
+	l5.close(fd1)
+	local fdl, msg, cred = assert(sock.recvfds(s1))
+	assert(#fdl == 1 and msg == "pipe")
+	assert(cred and cred.pid == l5.getpid())
+	assert(l5.write(fdl[1], "hello"))
+	l5.close(fdl[1])
+	assert(l5.read(fd0) == "hello")
+	l5.close(fd0)
+	sock.close(s0)
+	local r, eno = sock.recvfds(s1)
+	assert(not r and eno == sock.EOF)
+	sock.close(s1)
+	print("test_fdpass ok.")
+end
+
+function test_connpool()
+	local connpool = require "l5.connpool"
+	local sa = sock.sockaddr("127.0.0.1", 10003)
+	local ss = assert(sock.sbind(sa))
+	local cp = connpool.new{maxperhost = 2}
+	-- (connect succeeds when the connection is queued in the
+	-- server backlog, before accept)
+	local so1 = assert(connpool.get(cp, sa))
+	local so2 = assert(connpool.get(cp, sa))
+	local r, eno = connpool.get(cp, sa)
+	assert(not r and eno == connpool.LIMIT)
+	-- an idle connection is reused
+	connpool.put(cp, so1)
+	assert(connpool.get(cp, sa) == so1)
+	-- a connection closed by the server is not reused
+	local cs = assert(sock.accept(ss)) -- the so1 connection
+	sock.close(cs)
+	l5.msleep(50)
+	connpool.put(cp, so1)
+	local so3 = assert(connpool.get(cp, sa))
+	assert(so3 ~= so1)
+	assert(connpool.count(cp, sa) == 2)
+	-- idle expiry
+	connpool.put(cp, so3)
+	assert(connpool.expire(cp) == 0)
+	local sec, nsec = l5.clock_gettime(1)
+	local now = sec * 1000 + nsec // 1000000
+	assert(connpool.expire(cp, now + cp.idle + 1000) == 1)
+	assert(connpool.count(cp) == 1)
+	connpool.discard(cp, so2)
+	-- non-blocking connect
+	cp = connpool.new{nonblocking = true}
+	local so = assert(connpool.get(cp, sa))
+	assert(sock.connected(so, 1000))
+	assert(not so.connecting)
+	connpool.discard(cp, so)
+	assert(connpool.count(cp) == 0)
+	sock.close(ss)
+	print("test_connpool ok.")
+end
+
+function test_zerocopy()
+	local sa = sock.sockaddr("127.0.0.1", 10004)
+	local ss = assert(sock.sbind(sa))
+	local cso = assert(sock.sconnect(sa))
+	local so = assert(sock.accept(ss))
+	-- send honours idx and count
+	assert(l5.send(cso.fd, "hello world", 0, 7, 5) == 5)
+	assert(sock.readbytes(so, 5) == "world")
+	local b = l5.buf_new(8, "abcdefgh")
+	assert(l5.send(cso.fd, b, 0, 3) == 6)
+	assert(sock.readbytes(so, 6) == "cdefgh")
+	l5.buf_free(b)
+	-- out of range idx or count
+	assert(l5.send(cso.fd, "abc", 0, 4) == 0)
+	assert(not pcall(l5.send, cso.fd, "abc", 0, 5))
+	assert(not pcall(l5.send, cso.fd, "abc", 0, 0))
+	assert(not pcall(l5.send, cso.fd, "abc", 0, 2, 3))
+	assert(not pcall(l5.send, cso.fd, "abc", 0, 2, -1))
+	assert(not pcall(l5.write, cso.fd, "abc", 10))
+	if not sock.zerocopy(cso) then
+		print("test_zerocopy: SO_ZEROCOPY not supported. skipped.")
+		sock.close(cso)
+	else
+		local big = ("0123456789abcdef"):rep(8192) -- 128 kbytes
+		local n = assert(sock.zcsend(cso, big))
+		assert(sock.zcpending(cso) == 1)
+		assert(sock.readbytes(so, n) == big:sub(1, n))
+		-- wait for the completion
+		for i = 1, 100 do
+			if sock.zcreap(cso) == 0 then break end
+			l5.msleep(10)
+		end
+		assert(sock.zcpending(cso) == 0)
+		-- (on loopback the kernel copies the data)
+		assert(cso.zc.ncopied == 1)
+		-- close with a send not yet reaped: the data stays 
+		-- referenced until the completion is reaped
+		n = assert(sock.zcsend(cso, big))
+		assert(sock.close(cso))
+		assert(sock.readbytes(so, n) == big:sub(1, n))
+		for i = 1, 100 do
+			if sock.zclinger() == 0 then break end
+			l5.msleep(10)
+		end
+		assert(sock.zclinger() == 0)
+		assert(not cso.zc)
+	end
+	sock.close(so)
+	sock.close(ss)
+	print("test_zerocopy ok.")
+end
+
 ------------------------------------------------------------------------
 
 print("------------------------------------------------------------")
@@ -223,6 +384,11 @@ print("test_sock...")
 test_stream_read()
 test_stream()
 test_datagram0()
+test_reader()
+test_netlink()
+test_fdpass()
+test_connpool()
+test_zerocopy()
 print("test_sock ok.")
 
 